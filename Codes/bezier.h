@@ -0,0 +1,400 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"surface.h"
+#include"bvh.h"
+#include<algorithm>
+
+//Bezier outlines.
+//Lenses and reflectors are closed loops of quadratic and cubic Bezier
+//curves. The curves are cut where they turn in x or y, so that every piece
+//is monotone in both and its box is the one of its ends; a BVH over these
+//boxes finds the few pieces a ray may cross. The line of a ray crosses a
+//piece where the signed distance to it, a cubic whose Bernstein
+//coefficients are the distances of the control points, is zero: the
+//piece is split until that cubic has one sign change, then Newton's
+//method, kept within the bracket, finds the root. Inside is by the
+//nonzero winding rule, as in mesh.h.
+
+struct CubicBezier
+{
+	Point2d p[4];	//control points
+
+	CubicBezier() {}
+	CubicBezier(const Point2d& p0, const Point2d& p1, const Point2d& p2, const Point2d& p3)
+	{
+		p[0] = p0, p[1] = p1, p[2] = p2, p[3] = p3;
+	}
+	//a quadratic curve is a cubic one exactly
+	static CubicBezier Quadratic(const Point2d& p0, const Point2d& p1, const Point2d& p2)
+	{
+		return CubicBezier(p0, p0 + (p1 - p0) * (2.0 / 3), p2 + (p1 - p2) * (2.0 / 3), p2);
+	}
+	static CubicBezier Line(const Point2d& p0, const Point2d& p1)
+	{
+		return CubicBezier(p0, p0 + (p1 - p0) / 3, p0 + (p1 - p0) * (2.0 / 3), p1);
+	}
+
+	Point2d operator()(double u) const
+	{
+		double v = 1 - u;
+		return Point2d(
+			v * v * v * p[0].x + 3 * v * v * u * p[1].x + 3 * v * u * u * p[2].x + u * u * u * p[3].x,
+			v * v * v * p[0].y + 3 * v * v * u * p[1].y + 3 * v * u * u * p[2].y + u * u * u * p[3].y);
+	}
+	Vector2d Derivative(double u) const
+	{
+		double v = 1 - u;
+		return (p[1] - p[0]) * (3 * v * v) + (p[2] - p[1]) * (6 * v * u) + (p[3] - p[2]) * (3 * u * u);
+	}
+	//the part from u0 to u1, by de Casteljau
+	CubicBezier Segment(double u0, double u1) const
+	{
+		CubicBezier left = split(u1, true);
+		return u1 > 0 ? left.split(u0 / u1, false) : left;
+	}
+
+private:
+	CubicBezier split(double u, bool first) const
+	{
+		Point2d a = p[0] + (p[1] - p[0]) * u, b = p[1] + (p[2] - p[1]) * u, c = p[2] + (p[3] - p[2]) * u;
+		Point2d ab = a + (b - a) * u, bc = b + (c - b) * u;
+		Point2d m = ab + (bc - ab) * u;
+		return first ? CubicBezier(p[0], a, ab, m) : CubicBezier(m, bc, c, p[3]);
+	}
+};
+
+class BezierShape :public Surface
+{
+public:
+	//Adds the closed loop of curves, each starting where the last ended,
+	//turned counter-clockwise or clockwise for a hole; Build afterwards
+	void AddLoop(const std::vector<CubicBezier>& curves, bool hole = false)
+	{
+		//signed area of the loop by its chords
+		double area = 0;
+		for (auto& c : curves)
+			for (int k = 0; k < 16; k++)
+			{
+				Point2d u = c(k / 16.0), v = c((k + 1) / 16.0);
+				area += u.x * v.y - v.x * u.y;
+			}
+		bool reverse = hole ? area > 0 : area < 0;
+		for (int i = 0; i < (int)curves.size(); i++)
+		{
+			const CubicBezier& c = curves[reverse ? curves.size() - 1 - i : i];
+			addMonotone(reverse ? CubicBezier(c.p[3], c.p[2], c.p[1], c.p[0]) : c);
+		}
+	}
+	void Build()
+	{
+		std::vector<Bounds2d> bounds(pieces.size());
+		cdf.assign(pieces.size() * Chords + 1, 0);
+		for (size_t i = 0; i < pieces.size(); i++)
+		{
+			bounds[i] = Bounds2d(pieces[i].p[0], pieces[i].p[3]);
+			bounds[i].pMin = bounds[i].pMin - Vector2d(EPSILON, EPSILON);
+			bounds[i].pMax = bounds[i].pMax + Vector2d(EPSILON, EPSILON);
+			for (int k = 0; k < Chords; k++)
+			{
+				int j = (int)i * Chords + k;
+				cdf[j + 1] = cdf[j] + Distance(pieces[i]((double)k / Chords), pieces[i]((double)(k + 1) / Chords));
+			}
+		}
+		bvh.Build(bounds);
+	}
+
+	virtual bool isInside(const Point2d& p)
+	{
+		return winding(p) != 0;
+	}
+	virtual bool isOnBoundary(const Point2d& p)
+	{
+		return bvh.Query(p, [&](int i) {
+			double u;
+			return distance(pieces[i], p, &u) <= EPSILON;
+		});
+	}
+	//at the nearest point of the nearest piece around p
+	virtual Vector2d getNormal(const Point2d& p)
+	{
+		int nearest = -1;
+		double nearestDistance = InfinityDouble, nearestU = 0;
+		bvh.Query(p, [&](int i) {
+			double u, d = distance(pieces[i], p, &u);
+			if (d < nearestDistance)
+			{
+				nearestDistance = d;
+				nearest = i;
+				nearestU = u;
+			}
+			return false;
+		});
+		if (nearest < 0) return{ 0.f, 1.f };
+		return normal(nearest, nearestU);
+	}
+	//of the curve where IntersectT crossed it
+	virtual Vector2d HitNormal(const Point2d& p, const Hit& hit)
+	{
+		return hit.part < 0 ? getNormal(p) : normal(hit.part, hit.u);
+	}
+	virtual Bounds2d WorldBound()
+	{
+		return bvh.WorldBound();
+	}
+	//the chords, Chords of them per piece: DirectLighting takes its events
+	//from them, the rays between events still see the curves
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		for (auto& piece : pieces)
+			for (int k = 0; k < Chords; k++)
+				boundaries->push_back(Boundary::Segment(piece((double)k / Chords), piece((double)(k + 1) / Chords)));
+	}
+	//by the length of chords, Chords of them per piece
+	virtual bool SampleBoundary(double u, Point2d* p, Vector2d* n, double* length)
+	{
+		*length = cdf.back();
+		if (*length <= 0) return false;
+		double s = u * *length;
+		int j = (int)(std::upper_bound(cdf.begin(), cdf.end(), s) - cdf.begin()) - 1;
+		j = std::min(std::max(j, 0), (int)cdf.size() - 2);
+		double f = cdf[j + 1] > cdf[j] ? std::min((s - cdf[j]) / (cdf[j + 1] - cdf[j]), 1.0) : 0;
+		int i = j / Chords;
+		double v = (j % Chords + f) / Chords;
+		*p = pieces[i](v);
+		*n = normal(i, v);
+		return true;
+	}
+	virtual bool IntersectP(const Ray& ray)
+	{
+		if (isInside(ray.o)) return true;
+		return bvh.IntersectP(ray, [&](int i) {
+			double us[MaxRoots], ts[MaxRoots];
+			int n = crossings(pieces[i], ray, us, ts);
+			for (int k = 0; k < n; k++)
+				if (ts[k] >= 0 && ts[k] < ray.tMax) return true;
+			return false;
+		});
+	}
+	//the nearest crossing in [0, tMax), and where it is on which piece
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		Ray r = ray;	//shrinks as hits are found, to cull the BVH
+		int best = -1;
+		double bestU = 0;
+		bvh.Intersect(r, [&](int i) {
+			double us[MaxRoots], ts[MaxRoots];
+			int n = crossings(pieces[i], r, us, ts);
+			bool hit = false;
+			for (int k = 0; k < n; k++)
+				if (ts[k] >= 0 && ts[k] < r.tMax)
+				{
+					r.tMax = ts[k];
+					best = i;
+					bestU = us[k];
+					hit = true;
+				}
+			return hit;
+		});
+		if (best < 0) return false;
+		*hit = Hit{ r.tMax, this, best, 1, bestU };
+		return true;
+	}
+	virtual bool Intersect(const Ray& ray, Interaction* rec)
+	{
+		Hit hit;
+		if (!IntersectT(ray, &hit)) return false;
+		FillHit(ray, hit, rec);
+		return true;
+	}
+	//every crossing of the whole line, as PolygonMesh::Spans
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		WindingSpans hits;
+		auto collect = [&](const Ray& r, bool ahead) {
+			bvh.Intersect(r, [&](int i) {
+				double us[MaxRoots], ts[MaxRoots];
+				int n = crossings(pieces[i], r, us, ts);
+				for (int k = 0; k < n; k++)
+					if (ahead ? ts[k] >= 0 : ts[k] > 0)
+					{
+						Vector2d e = pieces[i].Derivative(us[k]);
+						hits.Add(ahead ? ts[k] : -ts[k], ray.d.x * e.y - ray.d.y * e.x > 0 ? -1 : 1);
+					}
+				return false;
+			});
+		};
+		collect(ray, true);
+		collect(Ray(ray.o, -ray.d), false);
+		return hits.Spans(this, spans);
+	}
+
+private:
+	static const int MaxRoots = 3;	//a line crosses a cubic curve 3 times at most
+	static const int Chords = 16;	//per piece, for SampleBoundary and getBoundaries
+
+	std::vector<CubicBezier> pieces;	//monotone in x and y, the inside on the left
+	BVH bvh;
+	std::vector<double> cdf;	//length of the chords before chord j
+
+	//cuts c where it turns in x or y
+	void addMonotone(const CubicBezier& c)
+	{
+		double cuts[4];	//two roots per axis at most
+		int n = 0;
+		for (int axis = 0; axis < 2; axis++)
+		{
+			//the derivative along axis is a quadratic in u
+			double a = c.p[1][axis] - c.p[0][axis], b = c.p[2][axis] - c.p[1][axis], d = c.p[3][axis] - c.p[2][axis];
+			double qa = a - 2 * b + d, qb = 2 * (b - a), qc = a;
+			if (qa == 0)
+			{
+				if (qb != 0) cuts[n++] = -qc / qb;
+				continue;
+			}
+			double discriminant = qb * qb - 4 * qa * qc;
+			if (discriminant < 0) continue;
+			double root = sqrt(discriminant);
+			cuts[n++] = (-qb - root) / (2 * qa);
+			cuts[n++] = (-qb + root) / (2 * qa);
+		}
+		for (int k = 1; k < n; k++)
+			for (int j = k; j > 0 && cuts[j - 1] > cuts[j]; j--)
+				std::swap(cuts[j - 1], cuts[j]);
+		double u0 = 0;
+		for (int k = 0; k < n; k++)
+			if (cuts[k] > u0 + 1e-9 && cuts[k] < 1 - 1e-9)
+			{
+				pieces.push_back(c.Segment(u0, cuts[k]));
+				u0 = cuts[k];
+			}
+		pieces.push_back(c.Segment(u0, 1));
+	}
+
+	Vector2d normal(int i, double u) const
+	{
+		Vector2d e = pieces[i].Derivative(u);
+		if (e.x == 0 && e.y == 0)	//a cusp, take the chord
+			e = pieces[i].p[3] - pieces[i].p[0];
+		return Normalize(Vector2d(e.y, -e.x));
+	}
+
+	//Where the line of ray crosses c: parameters on the curve into us and
+	//on the ray into ts; their number
+	int crossings(const CubicBezier& c, const Ray& ray, double* us, double* ts) const
+	{
+		double f[4];
+		for (int k = 0; k < 4; k++)
+		{
+			Vector2d v = c.p[k] - ray.o;
+			f[k] = ray.d.x * v.y - ray.d.y * v.x;
+		}
+		int n = 0;
+		roots(c, ray, f, 0, 1, us, &n, 0);
+		double dd = Dot(ray.d, ray.d);
+		for (int k = 0; k < n; k++)
+			ts[k] = Dot(c(us[k]) - ray.o, ray.d) / dd;
+		return n;
+	}
+	//the roots in [u0, u1] of the distance to the line, f its Bernstein
+	//coefficients over that interval
+	void roots(const CubicBezier& c, const Ray& ray, const double f[4], double u0, double u1, double* us, int* n, int depth) const
+	{
+		int changes = 0;
+		for (int k = 0; k < 3; k++)
+			changes += (f[k] < 0) != (f[k + 1] < 0);
+		if (changes == 0 || *n == MaxRoots) return;
+		if (changes == 1 && (f[0] < 0) != (f[3] < 0))
+		{
+			us[(*n)++] = newton(c, ray, u0, u1, f[0] < 0);
+			return;
+		}
+		if (depth == 30)	//grazing the curve
+		{
+			us[(*n)++] = (u0 + u1) / 2;
+			return;
+		}
+		//the halves, by de Casteljau on the coefficients
+		double a = (f[0] + f[1]) / 2, b = (f[1] + f[2]) / 2, d = (f[2] + f[3]) / 2;
+		double ab = (a + b) / 2, bd = (b + d) / 2, m = (ab + bd) / 2;
+		double left[4] = { f[0], a, ab, m }, right[4] = { m, bd, d, f[3] };
+		double um = (u0 + u1) / 2;
+		roots(c, ray, left, u0, um, us, n, depth + 1);
+		roots(c, ray, right, um, u1, us, n, depth + 1);
+	}
+	//the one root in [lo, hi], the distance being negative at lo if
+	//negativeAtLo; Newton's steps, bisection where they leave the bracket
+	double newton(const CubicBezier& c, const Ray& ray, double lo, double hi, bool negativeAtLo) const
+	{
+		double u = (lo + hi) / 2;
+		for (int k = 0; k < 50 && hi - lo > 1e-12; k++)
+		{
+			Vector2d v = c(u) - ray.o, dv = c.Derivative(u);
+			double f = ray.d.x * v.y - ray.d.y * v.x;
+			double df = ray.d.x * dv.y - ray.d.y * dv.x;
+			if (f == 0) return u;
+			if ((f < 0) == negativeAtLo) lo = u;
+			else hi = u;
+			double next = df != 0 ? u - f / df : lo - 1;
+			u = next > lo && next < hi ? next : (lo + hi) / 2;
+		}
+		return u;
+	}
+	//the one u in [0, 1] where the piece c, monotone in y, is at height y
+	static double atHeight(const CubicBezier& c, double y)
+	{
+		double lo = 0, hi = 1, u = 0.5;
+		bool rising = c.p[3].y > c.p[0].y;
+		for (int k = 0; k < 50 && hi - lo > 1e-12; k++)
+		{
+			double f = c(u).y - y, df = c.Derivative(u).y;
+			if (f == 0) return u;
+			if ((f < 0) == rising) lo = u;
+			else hi = u;
+			double next = df != 0 ? u - f / df : lo - 1;
+			u = next > lo && next < hi ? next : (lo + hi) / 2;
+		}
+		return u;
+	}
+	//the distance from p to c, *u being the parameter of the nearest point
+	static double distance(const CubicBezier& c, const Point2d& p, double* u)
+	{
+		//the nearest of a few samples, then Newton's steps on the
+		//derivative of the squared distance
+		double best = InfinityDouble;
+		for (int k = 0; k <= 8; k++)
+		{
+			double d = DistanceSquared(c(k / 8.0), p);
+			if (d < best)
+			{
+				best = d;
+				*u = k / 8.0;
+			}
+		}
+		for (int k = 0; k < 8; k++)
+		{
+			Vector2d v = c(*u) - p, dv = c.Derivative(*u);
+			double u1 = *u, v1 = 1 - u1;
+			Vector2d ddv = ((c.p[2] - c.p[1]) - (c.p[1] - c.p[0])) * (6 * v1) + ((c.p[3] - c.p[2]) - (c.p[2] - c.p[1])) * (6 * u1);
+			double g = Dot(v, dv), dg = Dot(dv, dv) + Dot(v, ddv);
+			if (dg <= 0) break;
+			*u = std::min(std::max(*u - g / dg, 0.0), 1.0);
+		}
+		return Distance(c(*u), p);
+	}
+	//crossings of the ray from p along +x, up through a piece counting +1
+	//and down -1; pieces own their lower end and not their upper one
+	int winding(const Point2d& p) const
+	{
+		int w = 0;
+		bvh.Intersect(Ray(p, Vector2d(1, 0)), [&](int i) {
+			const CubicBezier& c = pieces[i];
+			double y0 = c.p[0].y, y3 = c.p[3].y;
+			bool up = y0 <= p.y && y3 > p.y, down = y3 <= p.y && y0 > p.y;
+			if ((up || down) && c(atHeight(c, p.y)).x > p.x)
+				w += up ? 1 : -1;
+			return false;
+		});
+		return w;
+	}
+};
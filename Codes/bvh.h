@@ -0,0 +1,370 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"packet.h"
+#include<algorithm>
+
+//Node of a flattened BVH. Nodes are laid out depth-first, so the first
+//child of an interior node is the next node in the array.
+struct LinearBVHNode
+{
+	Bounds2d bounds;
+	union
+	{
+		int primitivesOffset;	//leaf
+		int secondChildOffset;	//interior
+	};
+	unsigned short nPrimitives;	//0 for interior nodes
+	unsigned char axis;
+};
+
+//Bounding volume hierarchy over anything that has a box.
+//Built with the surface area heuristic (perimeter in 2D), it only stores
+//primitive indices; the caller keeps the primitives and intersects them.
+class BVH
+{
+public:
+	std::vector<LinearBVHNode> nodes;
+	//primitive indices in leaf order
+	std::vector<int> primitives;
+
+	//blockSize: primitives the leaves test together at the cost of one,
+	//as the flattened stores of primitives.h do
+	BVH(int maxPrims = 4, int blockSize = 1)
+		:maxPrimsInNode(std::min(maxPrims, 255)), blockSize(std::max(blockSize, 1)) {}
+
+	void Build(const std::vector<Bounds2d>& bounds)
+	{
+		nodes.clear();
+		primitives.clear();
+		if (bounds.empty()) return;
+
+		std::vector<BuildPrimitive> prims(bounds.size());
+		for (size_t i = 0; i < bounds.size(); ++i)
+		{
+			prims[i].index = (int)i;
+			prims[i].bounds = bounds[i];
+			prims[i].centroid = bounds[i].Centroid();
+		}
+		nodes.reserve(2 * bounds.size());
+		primitives.reserve(bounds.size());
+		buildRecursive(prims, 0, (int)prims.size());
+	}
+
+	Bounds2d WorldBound() const
+	{
+		return nodes.empty() ? Bounds2d() : nodes[0].bounds;
+	}
+
+	//Visits the leaves front-to-back along the ray.
+	//intersect(index) returns whether the primitive was hit; it should shrink
+	//ray.tMax on a hit so that nodes behind the hit are culled.
+	template <typename F>
+	bool Intersect(const Ray& ray, F intersect) const
+	{
+		return traverse<false>(ray, [&](int offset, int n) {
+			bool hit = false;
+			for (int i = 0; i < n; ++i)
+				if (intersect(primitives[offset + i]))
+					hit = true;
+			return hit;
+		});
+	}
+	//Same walk for shadow rays, stops at the first primitive reported hit.
+	template <typename F>
+	bool IntersectP(const Ray& ray, F intersectP) const
+	{
+		return traverse<true>(ray, [&](int offset, int n) {
+			for (int i = 0; i < n; ++i)
+				if (intersectP(primitives[offset + i]))
+					return true;
+			return false;
+		});
+	}
+	//Same walks a leaf at a time: leaf(offset, n) gets the primitives
+	//primitives[offset, offset + n) of a leaf, for callers that keep theirs
+	//in leaf order.
+	template <typename F>
+	bool IntersectLeaves(const Ray& ray, F leaf) const
+	{
+		return traverse<false>(ray, leaf);
+	}
+	template <typename F>
+	bool IntersectPLeaves(const Ray& ray, F leaf) const
+	{
+		return traverse<true>(ray, leaf);
+	}
+
+	//Intersect for a packet: a node is visited while any lane still hits
+	//its box, in the order of the first lane. intersect(index) should
+	//shrink the tMax of the lanes it hits.
+	template <typename F>
+	void IntersectPacket(const RayPacket& packet, F intersect) const
+	{
+		IntersectPacketLeaves(packet, [&](unsigned lanes, int offset, int n) {
+			for (int i = 0; i < n; ++i)
+				intersect(primitives[offset + i]);
+		});
+	}
+	//Same a leaf at a time, as IntersectLeaves: leaf(lanes, offset, n) also
+	//gets the mask of the lanes that hit the leaf's box
+	template <typename F>
+	void IntersectPacketLeaves(const RayPacket& packet, F leaf) const
+	{
+		if (nodes.empty() || packet.count == 0) return;
+		int dirIsNeg[2] = { packet.invDx[0] < 0, packet.invDy[0] < 0 };
+
+		int toVisitOffset = 0, currentNodeIndex = 0;
+		int nodesToVisit[64];
+		while (true)
+		{
+			const LinearBVHNode& node = nodes[currentNodeIndex];
+			if (unsigned lanes = ::IntersectP(node.bounds, packet))
+			{
+				if (node.nPrimitives > 0)
+				{
+					leaf(lanes, node.primitivesOffset, node.nPrimitives);
+					if (toVisitOffset == 0) break;
+					currentNodeIndex = nodesToVisit[--toVisitOffset];
+				}
+				else if (dirIsNeg[node.axis])
+				{
+					nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+					currentNodeIndex = node.secondChildOffset;
+				}
+				else
+				{
+					nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+					currentNodeIndex = currentNodeIndex + 1;
+				}
+			}
+			else
+			{
+				if (toVisitOffset == 0) break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+		}
+	}
+
+	//Calls query(index) for every primitive whose box contains p,
+	//stops as soon as it returns true.
+	template <typename F>
+	bool Query(const Point2d& p, F query) const
+	{
+		if (nodes.empty()) return false;
+		int toVisitOffset = 0, currentNodeIndex = 0;
+		int nodesToVisit[64];
+		while (true)
+		{
+			const LinearBVHNode& node = nodes[currentNodeIndex];
+			if (node.bounds.Inside(p))
+			{
+				if (node.nPrimitives > 0)
+				{
+					for (int i = 0; i < node.nPrimitives; ++i)
+						if (query(primitives[node.primitivesOffset + i]))
+							return true;
+				}
+				else
+				{
+					nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+					currentNodeIndex = currentNodeIndex + 1;
+					continue;
+				}
+			}
+			if (toVisitOffset == 0) break;
+			currentNodeIndex = nodesToVisit[--toVisitOffset];
+		}
+		return false;
+	}
+
+private:
+	struct BuildPrimitive
+	{
+		int index;
+		Bounds2d bounds;
+		Point2d centroid;
+	};
+	int maxPrimsInNode;
+	int blockSize;
+
+	//SAH cost of testing n primitives
+	double intersectCost(int n) const
+	{
+		return (n + blockSize - 1) / blockSize;
+	}
+
+	template <bool anyHit, typename F>
+	bool traverse(const Ray& ray, F leaf) const
+	{
+		if (nodes.empty()) return false;
+		bool hit = false;
+		Vector2d invDir(1 / ray.d.x, 1 / ray.d.y);
+		int dirIsNeg[2] = { invDir.x < 0, invDir.y < 0 };
+
+		int toVisitOffset = 0, currentNodeIndex = 0;
+		int nodesToVisit[64];
+		while (true)
+		{
+			const LinearBVHNode& node = nodes[currentNodeIndex];
+			if (node.bounds.IntersectP(ray, invDir, dirIsNeg))
+			{
+				if (node.nPrimitives > 0)
+				{
+					if (leaf(node.primitivesOffset, node.nPrimitives))
+					{
+						if (anyHit) return true;
+						hit = true;
+					}
+					if (toVisitOffset == 0) break;
+					currentNodeIndex = nodesToVisit[--toVisitOffset];
+				}
+				else
+				{
+					//put the far child on the stack, visit the near one first
+					if (dirIsNeg[node.axis])
+					{
+						nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+						currentNodeIndex = node.secondChildOffset;
+					}
+					else
+					{
+						nodesToVisit[toVisitOffset++] = node.secondChildOffset;
+						currentNodeIndex = currentNodeIndex + 1;
+					}
+				}
+			}
+			else
+			{
+				if (toVisitOffset == 0) break;
+				currentNodeIndex = nodesToVisit[--toVisitOffset];
+			}
+		}
+		return hit;
+	}
+
+	int makeLeaf(std::vector<BuildPrimitive>& prims, int start, int end, int nodeIndex, const Bounds2d& bounds)
+	{
+		LinearBVHNode& node = nodes[nodeIndex];
+		node.bounds = bounds;
+		node.primitivesOffset = (int)primitives.size();
+		node.nPrimitives = (unsigned short)(end - start);
+		node.axis = 0;
+		for (int i = start; i < end; ++i)
+			primitives.push_back(prims[i].index);
+		return nodeIndex;
+	}
+
+	int buildRecursive(std::vector<BuildPrimitive>& prims, int start, int end)
+	{
+		int nodeIndex = (int)nodes.size();
+		nodes.push_back(LinearBVHNode());
+
+		Bounds2d bounds;
+		for (int i = start; i < end; ++i)
+			bounds = Union(bounds, prims[i].bounds);
+		int nPrims = end - start;
+		if (nPrims == 1)
+			return makeLeaf(prims, start, end, nodeIndex, bounds);
+
+		Bounds2d centroidBounds;
+		for (int i = start; i < end; ++i)
+			centroidBounds = Union(centroidBounds, prims[i].centroid);
+		int dim = centroidBounds.MaximumExtent();
+		//all centroids coincide, nothing to split on
+		if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim])
+		{
+			if (nPrims <= 65535)
+				return makeLeaf(prims, start, end, nodeIndex, bounds);
+			dim = -1;
+		}
+
+		int mid = (start + end) / 2;
+		if (dim < 0)
+		{
+			//keep leaves within nPrimitives' range by splitting in the middle
+			dim = 0;
+		}
+		else if (nPrims <= 2 && blockSize == 1)
+		{
+			std::nth_element(&prims[start], &prims[mid], &prims[end - 1] + 1,
+				[dim](const BuildPrimitive& a, const BuildPrimitive& b) {
+				return a.centroid[dim] < b.centroid[dim];
+			});
+		}
+		else
+		{
+			//SAH: bucket the centroids and take the cheapest split plane
+			const int nBuckets = 12;
+			int count[nBuckets] = { 0 };
+			Bounds2d bucketBounds[nBuckets];
+			for (int i = start; i < end; ++i)
+			{
+				int b = (int)(nBuckets * centroidBounds.Offset(prims[i].centroid)[dim]);
+				if (b == nBuckets) b = nBuckets - 1;
+				count[b]++;
+				bucketBounds[b] = Union(bucketBounds[b], prims[i].bounds);
+			}
+
+			//the buckets below each plane swept up, those above swept down
+			double cost[nBuckets - 1];
+			double invPerimeter = 1 / bounds.Perimeter();
+			Bounds2d b0, b1;
+			int count0 = 0, count1 = 0;
+			for (int i = 0; i < nBuckets - 1; ++i)
+			{
+				b0 = Union(b0, bucketBounds[i]);
+				count0 += count[i];
+				cost[i] = 0.125 + (count0 ? intersectCost(count0) * b0.Perimeter() * invPerimeter : 0);
+			}
+			for (int i = nBuckets - 2; i >= 0; --i)
+			{
+				b1 = Union(b1, bucketBounds[i + 1]);
+				count1 += count[i + 1];
+				cost[i] += count1 ? intersectCost(count1) * b1.Perimeter() * invPerimeter : 0;
+			}
+
+			double minCost = cost[0];
+			int minCostSplitBucket = 0;
+			for (int i = 1; i < nBuckets - 1; ++i)
+			{
+				if (cost[i] < minCost)
+				{
+					minCost = cost[i];
+					minCostSplitBucket = i;
+				}
+			}
+
+			double leafCost = intersectCost(nPrims);
+			if (nPrims > maxPrimsInNode || minCost < leafCost)
+			{
+				BuildPrimitive* pmid = std::partition(&prims[start], &prims[end - 1] + 1,
+					[=](const BuildPrimitive& pi) {
+					int b = (int)(nBuckets * centroidBounds.Offset(pi.centroid)[dim]);
+					if (b == nBuckets) b = nBuckets - 1;
+					return b <= minCostSplitBucket;
+				});
+				mid = (int)(pmid - &prims[0]);
+				if (mid == start || mid == end)
+				{
+					mid = (start + end) / 2;
+					std::nth_element(&prims[start], &prims[mid], &prims[end - 1] + 1,
+						[dim](const BuildPrimitive& a, const BuildPrimitive& b) {
+						return a.centroid[dim] < b.centroid[dim];
+					});
+				}
+			}
+			else
+				return makeLeaf(prims, start, end, nodeIndex, bounds);
+		}
+
+		buildRecursive(prims, start, mid);
+		int second = buildRecursive(prims, mid, end);
+		LinearBVHNode& node = nodes[nodeIndex];
+		node.bounds = bounds;
+		node.secondChildOffset = second;
+		node.nPrimitives = 0;
+		node.axis = (unsigned char)dim;
+		return nodeIndex;
+	}
+};
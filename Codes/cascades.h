@@ -0,0 +1,193 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"color.h"
+#include"svimg.h"
+#include"random.h"
+#include"object.h"
+#include"integrator.h"
+
+//Radiance cascades.
+//Cascade i is a grid of probes spaced spacing * 2^i apart, each casting
+//angles * 4^i rays over the distance interval [t_i, t_i+1), where the
+//intervals grow by 4 from one cascade to the next. Near light needs fine
+//positions but few directions, far light the other way round, so every
+//cascade costs about the same. Merging from the top cascade down gives
+//each probe of cascade 0 the radiance arriving over the whole range.
+struct CascadeSettings
+{
+	int spacing = 1;		//probe spacing of cascade 0, in pixels
+	int angles = 4;			//rays per probe of cascade 0
+	double interval = 1;	//length of the interval of cascade 0
+};
+
+class RadianceCascades
+{
+public:
+	RadianceCascades(const Point2i& resolution, const CascadeSettings& settings = CascadeSettings())
+		:resolution(resolution), settings(settings)
+	{
+		//the last cascade must reach past everything on screen
+		double diagonal = sqrt((double)resolution.x * resolution.x + (double)resolution.y * resolution.y);
+		count = 1;
+		while (intervalStart(count) < 2 * diagonal)
+			count++;
+	}
+
+	int Count() const { return count; }
+
+	//Renders the scene into img the way jitterSample does it for a pixel.
+	void Render(Image& img, Scene& s, const RenderSettings& settings, RenderStats* stats)
+	{
+		//merged radiance of the cascade above the one being built
+		std::vector<Color> upper;
+		Level upperLevel;
+		for (int i = count - 1; i >= 0; i--)
+		{
+			Level level = getLevel(i);
+			std::vector<Color> merged(level.nx * level.ny * level.angles, Color(0, 0, 0));
+
+			long long paths = 0, segments = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:paths,segments)
+			for (int v = 0; v < level.ny; v++)
+			{
+				RenderStats rowStats;
+				for (int u = 0; u < level.nx; u++)
+				{
+					Point2d p = level.probe(u, v);
+					for (int a = 0; a < level.angles; a++)
+					{
+						double transmittance;
+						RandomStream rng = RandomStream(v * level.nx + u, a, settings.seed).Child(ProbeStreams).Child(i);
+						Color c = traceInterval(s, p, level, a, &transmittance, rng, settings, &rowStats);
+						if (transmittance > 0)
+						{
+							if (i == count - 1)
+								c += Background * transmittance;
+							else
+								c += fetch(upper, upperLevel, p, a) * transmittance;
+						}
+						merged[(v * level.nx + u) * level.angles + a] = c;
+					}
+				}
+				paths += rowStats.paths;
+				segments += rowStats.segments;
+			}
+			if (stats)
+			{
+				stats->paths += paths;
+				stats->segments += segments;
+			}
+			upper.swap(merged);
+			upperLevel = level;
+		}
+
+		//cascade 0 is in upper now; average its directions at every pixel
+#pragma omp parallel for schedule(dynamic)
+		for (int y = 0; y < resolution.y; y++)
+			for (int x = 0; x < resolution.x; x++)
+			{
+				Color c = fluence(upper, upperLevel, Point2d(x, y));
+				c = Color(std::min(c.r, 255.0), std::min(c.g, 255.0), std::min(c.b, 255.0));
+				img.setPixel(Point2i(x, y), sqrtColor(c));
+			}
+	}
+
+private:
+	struct Level
+	{
+		int index = 0;
+		int spacing = 1;
+		int angles = 1;
+		int nx = 0, ny = 0;
+		double t0 = 0, t1 = 0;
+
+		//probes sit at the centres of spacing x spacing pixel blocks
+		Point2d probe(int u, int v) const
+		{
+			double offset = (spacing - 1) * 0.5;
+			return Point2d(u * spacing + offset, v * spacing + offset);
+		}
+		Vector2d direction(int a) const
+		{
+			double theta = PI * 2 * (a + 0.5) / angles;
+			return Vector2d(cos(theta), sin(theta));
+		}
+	};
+
+	Point2i resolution;
+	CascadeSettings settings;
+	int count;
+
+	double intervalStart(int i) const
+	{
+		return settings.interval * (pow(4.0, i) - 1) / 3;
+	}
+	Level getLevel(int i) const
+	{
+		Level l;
+		l.index = i;
+		l.spacing = settings.spacing << i;
+		l.angles = settings.angles << (2 * i);
+		l.nx = (resolution.x + l.spacing - 1) / l.spacing;
+		l.ny = (resolution.y + l.spacing - 1) / l.spacing;
+		l.t0 = intervalStart(i);
+		//the top cascade is open-ended
+		l.t1 = (i == count - 1) ? InfinityDouble : intervalStart(i + 1);
+		return l;
+	}
+
+	//Radiance gathered over the interval of direction a, and the fraction of
+	//light from beyond the interval that gets through (0 once something is hit).
+	Color traceInterval(Scene& s, const Point2d& p, const Level& level, int a, double* transmittance,
+		RandomStream& rng, const RenderSettings& settings, RenderStats* stats)
+	{
+		Vector2d d = level.direction(a);
+		Ray r(p + d * level.t0, d, level.t1 - level.t0);
+		Interaction inte;
+		if (s.Intersect(r, &inte))
+		{
+			*transmittance = 0;
+			return shade(r, &inte, s, rng, 0, settings, stats);
+		}
+		*transmittance = 1;
+		if (stats)
+		{
+			stats->paths++;
+			stats->segments++;
+		}
+		return Color(0, 0, 0);
+	}
+
+	//Bilinear lookup of the probes of level around p, averaged over the
+	//4 directions of level that a direction of the level below splits into.
+	Color fetch(const std::vector<Color>& radiance, const Level& level, const Point2d& p, int a) const
+	{
+		Color c(0, 0, 0);
+		for (int k = 0; k < 4; k++)
+			c += interpolate(radiance, level, p, 4 * a + k);
+		return c * 0.25;
+	}
+	Color fluence(const std::vector<Color>& radiance, const Level& level, const Point2d& p) const
+	{
+		Color c(0, 0, 0);
+		for (int a = 0; a < level.angles; a++)
+			c += interpolate(radiance, level, p, a);
+		return c * (1.0 / level.angles);
+	}
+	Color interpolate(const std::vector<Color>& radiance, const Level& level, const Point2d& p, int a) const
+	{
+		double offset = (level.spacing - 1) * 0.5;
+		double gx = std::min(std::max((p.x - offset) / level.spacing, 0.0), level.nx - 1.0);
+		double gy = std::min(std::max((p.y - offset) / level.spacing, 0.0), level.ny - 1.0);
+		int u0 = (int)gx, v0 = (int)gy;
+		int u1 = std::min(u0 + 1, level.nx - 1), v1 = std::min(v0 + 1, level.ny - 1);
+		double fx = gx - u0, fy = gy - v0;
+
+		auto at = [&](int u, int v) -> const Color& {
+			return radiance[(v * level.nx + u) * level.angles + a];
+		};
+		return (at(u0, v0) * (1 - fx) + at(u1, v0) * fx) * (1 - fy) +
+			(at(u0, v1) * (1 - fx) + at(u1, v1) * fx) * fy;
+	}
+};
@@ -14,6 +14,9 @@ public:
 	bool hasNaNs() const {
 		return false;
 	}
+	double MaxComponent() const {
+		return std::max(r, std::max(g, b));
+	}
 
 	Color(double r, double g, double b)
 	{
@@ -96,7 +99,7 @@ public:
 	Color operator*(const Color &c) const
 	{
 		double inv = 1.f / 255.f;
-		Color result(r *(c.r*inv), g *(c.r*inv), b *(c.r*inv));
+		Color result(r *(c.r*inv), g *(c.g*inv), b *(c.b*inv));
 		assert(!(c.hasNaNs() || result.hasNaNs()));
 		return result;
 	}
@@ -0,0 +1,302 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"color.h"
+#include"svimg.h"
+#include"surface.h"
+#include"object.h"
+#include<algorithm>
+
+//Exact direct lighting.
+//Seen from a point, the first surface along a direction can only change at
+//a few angles: the tangents of circles and ellipses, the two directions of
+//a line, the ends of a segment, and the points where two boundaries cross.
+//Between two such events the same object is hit, so one ray per elementary
+//interval tells whose emission covers it, and the emission integrated over
+//angle is a sum of widths.
+//Building costs a sort of the boundaries and a test of each pair whose
+//boxes overlap. Li costs, at each point, an angle per boundary and per
+//crossing, a sort of those within the lights, and a ray per interval
+//between them: outlines of thousands of segments in front of a light make
+//it that many rays per point, a preview rather than a renderer then.
+
+//Where ellipse e crosses the circle or ellipse other, up to four points
+//into found: the angles of e at which other's implicit function changes
+//sign, among EllipseSteps, are refined by bisection. Crossings closer than
+//a step, or where they only touch, may be missed.
+const int EllipseSteps = 64;
+inline int ellipseCrossings(const Boundary& e, const Boundary& other, Point2d* found)
+{
+	auto f = [&](double theta) {
+		Point2d p = e.EllipsePoint(theta);
+		if (other.isCircle)
+			return (p - other.c).LengthSquared() - other.r * other.r;
+		return other.EllipseFrame(p).LengthSquared() - 1;
+	};
+	int n = 0;
+	double theta0 = 0, f0 = f(0);
+	for (int k = 1; k <= EllipseSteps && n < 4; k++)
+	{
+		double theta1 = 2 * PI * k / EllipseSteps, f1 = f(theta1);
+		if ((f0 < 0) != (f1 < 0))
+		{
+			double lo = theta0, hi = theta1;
+			for (int i = 0; i < 50; i++)
+			{
+				double mid = 0.5 * (lo + hi);
+				if ((f(mid) < 0) == (f0 < 0)) lo = mid;
+				else hi = mid;
+			}
+			found[n++] = e.EllipsePoint(0.5 * (lo + hi));
+		}
+		theta0 = theta1;
+		f0 = f1;
+	}
+	return n;
+}
+
+//Appends the points where two boundaries cross
+void boundaryCrossings(const Boundary& b1, const Boundary& b2, std::vector<Point2d>* points)
+{
+	//where their lines, circles and ellipses cross, four points at most
+	Point2d found[4];
+	int n = 0;
+	if (b1.isEllipse || b2.isEllipse)
+	{
+		const Boundary& e = b1.isEllipse ? b1 : b2;
+		const Boundary& other = b1.isEllipse ? b2 : b1;
+		if (other.isCircle || other.isEllipse)
+			n = ellipseCrossings(e, other, found);
+		else
+		{
+			//a cos(theta) + b sin(theta) = k along the line
+			double a = other.a * e.u.x + other.b * e.u.y, b = other.a * e.v.x + other.b * e.v.y;
+			double k = -(other.a * e.c.x + other.b * e.c.y + other.lc), len = sqrt(a * a + b * b);
+			if (len == 0 || fabs(k) > len) return;
+			double phi = atan2(b, a), alpha = acos(k / len);
+			found[n++] = e.EllipsePoint(phi + alpha);
+			found[n++] = e.EllipsePoint(phi - alpha);
+		}
+	}
+	else if (b1.isCircle && b2.isCircle)
+	{
+		Vector2d d = b2.c - b1.c;
+		double dist = d.Length();
+		if (dist == 0 || dist > b1.r + b2.r || dist < fabs(b1.r - b2.r)) return;
+		double a = (b1.r * b1.r - b2.r * b2.r + dist * dist) / (2 * dist);
+		double h = sqrt(std::max(b1.r * b1.r - a * a, 0.0));
+		Point2d m = b1.c + d * (a / dist);
+		Vector2d normal(-d.y / dist, d.x / dist);
+		found[n++] = m + normal * h;
+		found[n++] = m - normal * h;
+	}
+	else if (b1.isCircle || b2.isCircle)
+	{
+		const Boundary& circle = b1.isCircle ? b1 : b2;
+		const Boundary& line = b1.isCircle ? b2 : b1;
+		double len2 = line.a * line.a + line.b * line.b;
+		if (len2 == 0) return;
+		//foot of the centre on the line
+		double s = (line.a * circle.c.x + line.b * circle.c.y + line.lc) / len2;
+		Point2d foot = circle.c - Vector2d(line.a, line.b) * s;
+		double h2 = circle.r * circle.r - s * s * len2;
+		if (h2 < 0) return;
+		Vector2d along = Vector2d(line.b, -line.a) * (sqrt(h2 / len2));
+		found[n++] = foot + along;
+		found[n++] = foot - along;
+	}
+	else
+	{
+		double det = b1.a * b2.b - b2.a * b1.b;
+		if (det == 0) return;
+		found[n++] = Point2d((b1.b * b2.lc - b2.b * b1.lc) / det, (b2.a * b1.lc - b1.a * b2.lc) / det);
+	}
+	for (int i = 0; i < n; i++)
+		if (b1.Covers(found[i]) && b2.Covers(found[i]))
+			points->push_back(found[i]);
+}
+
+class DirectLighting
+{
+public:
+	//Gathers the boundaries of s and their crossings. Build again when the
+	//scene changes.
+	DirectLighting(Scene& s) :scene(s)
+	{
+		//each boundary with the box it lies in, within its object's
+		std::vector<Bounds2d> boxes;
+		for (auto& i : s.scene_list)
+		{
+			std::vector<Boundary> b;
+			i->surface->getBoundaries(&b);
+			Bounds2d bound = i->surface->WorldBound();
+			for (auto& bd : b)
+			{
+				Bounds2d box = ::Intersect(boundaryBound(bd), bound);
+				box.pMin = box.pMin - Vector2d(EPSILON, EPSILON);
+				box.pMax = box.pMax + Vector2d(EPSILON, EPSILON);
+				boundaries.push_back(bd);
+				boxes.push_back(box);
+			}
+			if (i->material->isLight)
+				lights.push_back(i);
+		}
+
+		//a crossing lies in the boxes of both: sweep the boxes along x, each
+		//against those starting before it ends
+		std::vector<int> order(boundaries.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = (int)i;
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return boxes[a].pMin.x < boxes[b].pMin.x; });
+		for (size_t k = 0; k < order.size(); k++)
+		{
+			const Bounds2d& a = boxes[order[k]];
+			if (a.IsEmpty()) continue;
+			for (size_t m = k + 1; m < order.size() && boxes[order[m]].pMin.x <= a.pMax.x; m++)
+			{
+				Bounds2d both = ::Intersect(a, boxes[order[m]]);
+				if (both.IsEmpty()) continue;
+				size_t first = vertices.size();
+				boundaryCrossings(boundaries[order[k]], boundaries[order[m]], &vertices);
+				vertices.erase(std::remove_if(vertices.begin() + first, vertices.end(), [&](const Point2d& p) {
+					return !both.Inside(p);
+				}), vertices.end());
+			}
+		}
+	}
+
+	//Emission of the first hit averaged over all the directions at p,
+	//which is what trace() gathers at depth 0
+	Color Li(const Point2d& p) const
+	{
+		//angular extents of the lights, a light around p covers everything
+		std::vector<double> events;
+		std::vector<std::pair<double, double>> cones;
+		bool everywhere = false;
+		for (auto& l : lights)
+		{
+			double phi, halfAngle;
+			if (!l->surface->AngularBound(p, &phi, &halfAngle))
+			{
+				everywhere = true;
+				continue;
+			}
+			cones.push_back(std::make_pair(phi, halfAngle));
+			events.push_back(phi - halfAngle);
+			events.push_back(phi + halfAngle);
+		}
+		if (!everywhere && cones.empty())
+			return Color(0, 0, 0);
+
+		for (auto& b : boundaries)
+		{
+			if (b.isCircle)
+			{
+				Vector2d pc = b.c - p;
+				double dist = pc.Length();
+				if (dist <= b.r) continue;
+				double phi = atan2(pc.y, pc.x), halfAngle = asin(b.r / dist);
+				events.push_back(phi - halfAngle);
+				events.push_back(phi + halfAngle);
+			}
+			else if (b.isEllipse)
+			{
+				//tangents to the unit circle in its frame are tangents still
+				Vector2d q = b.EllipseFrame(p);
+				double dist = q.Length();
+				if (dist <= 1) continue;
+				double phi = atan2(q.y, q.x), alpha = acos(1 / dist);
+				Point2d t0 = b.EllipsePoint(phi - alpha), t1 = b.EllipsePoint(phi + alpha);
+				events.push_back(atan2(t0.y - p.y, t0.x - p.x));
+				events.push_back(atan2(t1.y - p.y, t1.x - p.x));
+			}
+			else if (b.isSegment)
+			{
+				events.push_back(atan2(b.p0.y - p.y, b.p0.x - p.x));
+				events.push_back(atan2(b.p1.y - p.y, b.p1.x - p.x));
+			}
+			else
+			{
+				double phi = atan2(-b.a, b.b);
+				events.push_back(phi);
+				events.push_back(phi + PI);
+			}
+		}
+		for (auto& v : vertices)
+			events.push_back(atan2(v.y - p.y, v.x - p.x));
+
+		//fold into [-PI, PI), and leave out those no light is behind
+		for (auto& e : events)
+			e = fold(e);
+		if (!everywhere)
+			events.erase(std::remove_if(events.begin(), events.end(), [&](double e) {
+				return std::none_of(cones.begin(), cones.end(), [&](const std::pair<double, double>& c) {
+					return fabs(fold(e - c.first)) <= c.second + 1e-9;
+				});
+			}), events.end());
+		if (events.empty())
+			events.push_back(-PI);
+		std::sort(events.begin(), events.end());
+
+		Color sum(0, 0, 0);
+		for (size_t k = 0; k < events.size(); k++)
+		{
+			double t0 = events[k];
+			double t1 = k + 1 < events.size() ? events[k + 1] : events[0] + 2 * PI;
+			if (t1 - t0 < 1e-9) continue;
+			double theta = 0.5 * (t0 + t1);
+			Vector2d d(cos(theta), sin(theta));
+			if (!everywhere && std::none_of(cones.begin(), cones.end(), [&](const std::pair<double, double>& c) {
+				Vector2d axis(cos(c.first), sin(c.first));
+				return fabs(atan2(axis.x * d.y - axis.y * d.x, Dot(axis, d))) <= c.second;
+			}))
+				continue;
+
+			Interaction inte;
+			if (scene.Intersect(Ray(p, d), &inte) && inte.mat->isLight)
+				sum += materialLi(inte.mat) * (t1 - t0);
+		}
+		return sum * Inv_2PI;
+	}
+
+	//direct-only preview of the scene
+	void Render(Image& img) const
+	{
+		const int w = img.fullResolution.x;
+		const int h = img.fullResolution.y;
+#pragma omp parallel for schedule(dynamic)
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++)
+			{
+				Color c = Li(Point2d(x, y));
+				c = Color(std::min(c.r, 255.0), std::min(c.g, 255.0), std::min(c.b, 255.0));
+				img.setPixel(Point2i(x, y), sqrtColor(c));
+			}
+	}
+
+private:
+	static double fold(double angle)
+	{
+		angle = fmod(angle + PI, 2 * PI);
+		if (angle < 0) angle += 2 * PI;
+		return angle - PI;
+	}
+	static Bounds2d boundaryBound(const Boundary& b)
+	{
+		if (b.isCircle)
+			return Bounds2d(b.c - Vector2d(b.r, b.r), b.c + Vector2d(b.r, b.r));
+		if (b.isEllipse)
+		{
+			Vector2d half(sqrt(b.u.x * b.u.x + b.v.x * b.v.x), sqrt(b.u.y * b.u.y + b.v.y * b.v.y));
+			return Bounds2d(b.c - half, b.c + half);
+		}
+		if (b.isSegment)
+			return Bounds2d(b.p0, b.p1);
+		return Bounds2d(Point2d(-InfinityDouble, -InfinityDouble), Point2d(InfinityDouble, InfinityDouble));
+	}
+
+	Scene& scene;
+	std::vector<Boundary> boundaries;
+	std::vector<Point2d> vertices;	//crossings of boundaries
+	std::vector<Object*> lights;
+};
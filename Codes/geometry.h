@@ -591,6 +591,115 @@ Point3<T> Abs(const Point3<T> & p) {
 	return Point3<T>(std::abs(p.x), std::abs(p.y), std::abs(p.z));
 }
 
+//Bounds Declarations
+//Axis-aligned box; the bounds of unbounded surfaces hold infinities.
+template <typename T>
+class Bounds2
+{
+public:
+	//Public Data
+	Point2<T> pMin, pMax;
+
+	//Constructors
+	//Default one is empty, so that it is the identity of Union
+	Bounds2()
+	{
+		T minNum = std::numeric_limits<T>::lowest();
+		T maxNum = std::numeric_limits<T>::max();
+		pMin = Point2<T>(maxNum, maxNum);
+		pMax = Point2<T>(minNum, minNum);
+	}
+	explicit Bounds2(const Point2<T>& p) : pMin(p), pMax(p) {}
+	Bounds2(const Point2<T>& p1, const Point2<T>& p2)
+		: pMin(std::min(p1.x, p2.x), std::min(p1.y, p2.y)),
+		pMax(std::max(p1.x, p2.x), std::max(p1.y, p2.y)) {}
+
+	const Point2<T>& operator[](int i) const
+	{
+		assert(i == 0 || i == 1);
+		return (i == 0) ? pMin : pMax;
+	}
+	Point2<T>& operator[](int i)
+	{
+		assert(i == 0 || i == 1);
+		return (i == 0) ? pMin : pMax;
+	}
+
+	bool IsEmpty() const { return pMin.x > pMax.x || pMin.y > pMax.y; }
+	bool IsFinite() const
+	{
+		return std::isfinite(pMin.x) && std::isfinite(pMin.y) &&
+			std::isfinite(pMax.x) && std::isfinite(pMax.y);
+	}
+	Vector2<T> Diagonal() const { return pMax - pMin; }
+	Point2<T> Centroid() const { return Point2<T>((pMin.x + pMax.x) / 2, (pMin.y + pMax.y) / 2); }
+	T Area() const
+	{
+		Vector2<T> d = pMax - pMin;
+		return d.x * d.y;
+	}
+	//In 2D a random line hits a convex region with probability
+	//proportional to its perimeter (Cauchy-Crofton), so SAH uses this.
+	T Perimeter() const
+	{
+		Vector2<T> d = pMax - pMin;
+		return 2 * (d.x + d.y);
+	}
+	int MaximumExtent() const
+	{
+		Vector2<T> d = Diagonal();
+		return (d.x > d.y) ? 0 : 1;
+	}
+	//position of p relative to the corners: (0,0) at pMin, (1,1) at pMax
+	Vector2<T> Offset(const Point2<T>& p) const
+	{
+		Vector2<T> o = p - pMin;
+		if (pMax.x > pMin.x) o.x /= pMax.x - pMin.x;
+		if (pMax.y > pMin.y) o.y /= pMax.y - pMin.y;
+		return o;
+	}
+	bool Inside(const Point2<T>& p) const
+	{
+		return p.x >= pMin.x && p.x <= pMax.x && p.y >= pMin.y && p.y <= pMax.y;
+	}
+
+	inline bool IntersectP(const Ray& ray, const Vector2d& invDir, const int dirIsNeg[2]) const;
+};
+
+template <typename T>
+inline std::ostream& operator<<(std::ostream& os, const Bounds2<T>& b)
+{
+	os << "[ " << b.pMin << " - " << b.pMax << " ]";
+	return os;
+}
+template <typename T>
+Bounds2<T> Union(const Bounds2<T>& b, const Point2<T>& p)
+{
+	Bounds2<T> ret;
+	ret.pMin = Min(b.pMin, p);
+	ret.pMax = Max(b.pMax, p);
+	return ret;
+}
+template <typename T>
+Bounds2<T> Union(const Bounds2<T>& b1, const Bounds2<T>& b2)
+{
+	Bounds2<T> ret;
+	ret.pMin = Min(b1.pMin, b2.pMin);
+	ret.pMax = Max(b1.pMax, b2.pMax);
+	return ret;
+}
+template <typename T>
+Bounds2<T> Intersect(const Bounds2<T>& b1, const Bounds2<T>& b2)
+{
+	Bounds2<T> ret;
+	ret.pMin = Max(b1.pMin, b2.pMin);
+	ret.pMax = Min(b1.pMax, b2.pMax);
+	return ret;
+}
+
+typedef Bounds2<int> Bounds2i;
+typedef Bounds2<double> Bounds2d;
+
 //Normal Declaration
 template <typename T>
 class Normal3
@@ -817,3 +926,19 @@ inline std::ostream & operator<<(std::ostream & os, const Ray & r)
 	os << "[o=" << r.o << ", d=" << r.d << ", tMax=" << r.tMax << "]";
 	return os;
 }
+
+//Slab test against the box, clipped to [0, ray.tMax]
+template <typename T>
+inline bool Bounds2<T>::IntersectP(const Ray& ray, const Vector2d& invDir, const int dirIsNeg[2]) const
+{
+	const Bounds2<T>& bounds = *this;
+	double tMin = (bounds[dirIsNeg[0]].x - ray.o.x) * invDir.x;
+	double tMax = (bounds[1 - dirIsNeg[0]].x - ray.o.x) * invDir.x;
+	double tyMin = (bounds[dirIsNeg[1]].y - ray.o.y) * invDir.y;
+	double tyMax = (bounds[1 - dirIsNeg[1]].y - ray.o.y) * invDir.y;
+
+	if (tMin > tyMax || tyMin > tMax) return false;
+	if (tyMin > tMin) tMin = tyMin;
+	if (tyMax < tMax) tMax = tyMax;
+	return (tMin < ray.tMax) && (tMax > 0);
+}
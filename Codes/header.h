@@ -30,5 +30,5 @@ class Camera;
 class Material;
 
 
-class Matrix4x4;
+class Matrix3x3;
 class Transform;
\ No newline at end of file
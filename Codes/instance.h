@@ -0,0 +1,165 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"surface.h"
+#include"transform.h"
+#include<algorithm>
+
+//Instances.
+//An Instance places a shape, which stays the caller's and may be shared
+//by any number of instances, in the world through a Transform: rays and
+//points go into the shape's space, hits come back out. A part repeated
+//a thousand times is then stored once, plus a transform for each copy.
+class Instance :public Surface
+{
+public:
+	Instance(Surface* shape, const Transform& objectToWorld)
+		:shape(shape), objectToWorld(objectToWorld), worldToObject(Inverse(objectToWorld))
+	{
+		double scale;
+		if (!objectToWorld.IsSimilarity(&scale))
+			buildStretch();
+	}
+
+	//EPSILON is measured in the shape's space
+	virtual bool isInside(const Point2d& p)
+	{
+		return shape->isInside(worldToObject(p));
+	}
+	virtual bool isOnBoundary(const Point2d& p)
+	{
+		return shape->isOnBoundary(worldToObject(p));
+	}
+	virtual Vector2d getNormal(const Point2d& p)
+	{
+		return Normalize(objectToWorld.Normal(shape->getNormal(worldToObject(p))));
+	}
+	virtual Bounds2d WorldBound()
+	{
+		return objectToWorld(shape->WorldBound());
+	}
+	//lines and segments stay so; circles only under a similarity, they
+	//become ellipses otherwise
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		std::vector<Boundary> local;
+		shape->getBoundaries(&local);
+		const Matrix3x3& mInv = worldToObject.GetMatrix();
+		double scale;
+		bool similar = objectToWorld.IsSimilarity(&scale);
+		for (auto& bd : local)
+		{
+			if (bd.isCircle && similar)
+			{
+				boundaries->push_back(Boundary::Circle(objectToWorld(bd.c), bd.r * scale));
+				continue;
+			}
+			if (bd.isCircle)
+			{
+				boundaries->push_back(Boundary::Ellipse(objectToWorld(bd.c),
+					objectToWorld(Vector2d(bd.r, 0)), objectToWorld(Vector2d(0, bd.r))));
+				continue;
+			}
+			if (bd.isEllipse)
+			{
+				boundaries->push_back(Boundary::Ellipse(objectToWorld(bd.c), objectToWorld(bd.u), objectToWorld(bd.v)));
+				continue;
+			}
+			if (bd.isSegment)
+			{
+				boundaries->push_back(Boundary::Segment(objectToWorld(bd.p0), objectToWorld(bd.p1)));
+				continue;
+			}
+			//a x + b y + c = 0 at the object's point, which is mInv times the world's
+			boundaries->push_back(Boundary::Line(
+				bd.a * mInv.m[0][0] + bd.b * mInv.m[1][0],
+				bd.a * mInv.m[0][1] + bd.b * mInv.m[1][1],
+				bd.a * mInv.m[0][2] + bd.b * mInv.m[1][2] + bd.lc));
+		}
+	}
+	//A similarity keeps lengths in proportion. Other maps stretch the
+	//boundary unevenly, so u is first warped by the table of stretches
+	//buildStretch made, the shape's u being uniform by its own length.
+	virtual bool SampleBoundary(double u, Point2d* p, Vector2d* n, double* length)
+	{
+		double scale;
+		if (objectToWorld.IsSimilarity(&scale))
+		{
+			if (!shape->SampleBoundary(u, p, n, length))
+				return false;
+			*length *= scale;
+		}
+		else
+		{
+			if (stretch.empty()) return false;
+			double s = u * stretch.back();
+			int k = (int)(std::upper_bound(stretch.begin(), stretch.end(), s) - stretch.begin()) - 1;
+			k = std::min(std::max(k, 0), StretchSteps - 1);
+			double f = stretch[k + 1] > stretch[k] ? std::min((s - stretch[k]) / (stretch[k + 1] - stretch[k]), 1.0) : 0;
+			if (!shape->SampleBoundary((k + f) / StretchSteps, p, n, length))
+				return false;
+			*length *= stretch.back() / StretchSteps;
+		}
+		*p = objectToWorld(*p);
+		*n = Normalize(objectToWorld.Normal(*n));
+		return true;
+	}
+	virtual bool IntersectP(const Ray& ray)
+	{
+		return shape->IntersectP(worldToObject(ray));
+	}
+	//t is the same in both spaces, the directions not being normalized
+	virtual bool Intersect(const Ray& ray, Interaction* rec)
+	{
+		if (!shape->Intersect(worldToObject(ray), rec)) return false;
+		rec->p = ray(rec->t);
+		rec->n = Normalize(objectToWorld.Normal(rec->n));
+		rec->wo = Vector2d(-ray.d);
+		return true;
+	}
+	//the shape's own part is lost on the way out, so the normal is getNormal's
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		Hit local;
+		if (!shape->IntersectT(worldToObject(ray), &local)) return false;
+		*hit = Hit{ local.t, this, -1, 1, 0 };
+		return true;
+	}
+	//the shape's spans, whose crossings then ask this for their normal in
+	//the world, which getNormal already turns outward
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		int n = shape->Spans(worldToObject(ray), spans);
+		for (int i = 0; i < n; i++)
+		{
+			if (spans[i].s0) spans[i].s0 = this, spans[i].sign0 = 1;
+			if (spans[i].s1) spans[i].s1 = this, spans[i].sign1 = 1;
+		}
+		return n;
+	}
+
+private:
+	static const int StretchSteps = 256;
+
+	Surface* shape;
+	Transform objectToWorld, worldToObject;
+	//how much the map lengthens the boundary before each of StretchSteps
+	//equal parts of the shape's, summed; empty under a similarity or for
+	//shapes that cannot sample their boundary
+	std::vector<double> stretch;
+
+	void buildStretch()
+	{
+		std::vector<double> sums(StretchSteps + 1, 0);
+		for (int k = 0; k < StretchSteps; k++)
+		{
+			Point2d p;
+			Vector2d n;
+			double length;
+			if (!shape->SampleBoundary((k + 0.5) / StretchSteps, &p, &n, &length))
+				return;
+			sums[k + 1] = sums[k] + objectToWorld(Vector2d(n.y, -n.x)).Length();
+		}
+		stretch = sums;
+	}
+};
@@ -0,0 +1,343 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"color.h"
+#include"svimg.h"
+#include"object.h"
+#include"material.h"
+#include"random.h"
+#include"direct.h"
+
+const int DEPTH = 50;
+//radiance of rays that leave the scene
+const Color Background(6, 6, 6);
+
+#ifdef DEBUG
+extern Image debug;
+#endif
+
+void drawLine(Image& img, const Point2d& p1, const Point2d& p2)
+{
+
+	int dx = p2.x - p1.x, dy = p2.y - p1.y, steps, k;
+	float xIncrement, yIncrement, x = p1.x, y = p1.y;
+
+	if (fabs(dx) > fabs(dy))
+		steps = fabs(dx);
+	else
+		steps = fabs(dy);
+
+	xIncrement = float(dx) / float(steps);
+	yIncrement = float(dy) / float(steps);
+
+	img.setPixel(Point2i(round(x), round(y)), Color(255, 0, 0));
+	for (k = 0; k < steps; k++) {
+		x += xIncrement;
+		y += yIncrement;
+
+		//if (y >= H)y = H - 1;
+		//else if (y < 0)y = 0;
+
+		//if (x >= W)x = W - 1;
+		//else if (x < 0)x = 0;
+
+
+		img.setPixel(Point2i(round(x), round(y)), Color(255, 0, 0));
+	}
+}
+
+//Per-render knobs of the path integrator
+struct RenderSettings
+{
+	int maxDepth = DEPTH;
+	//Russian roulette: once a path has made rrMinDepth bounces and its
+	//throughput has dropped below rrThreshold, it survives with a
+	//probability equal to its throughput and is reweighted if it does.
+	int rrMinDepth = 3;
+	double rrThreshold = 1.0;
+	//next-event estimation: aim one ray at a light from every vertex whose
+	//direction was not picked by a specular scatter
+	bool nee = true;
+	//when set, the light seen straight from the pixel is taken from here
+	//and left out of the paths
+	const DirectLighting* direct = nullptr;
+	//light that reaches the path through specular scatters only is left
+	//to a photon map, see photonmap.h
+	bool causticPhotons = false;
+	//Adaptive sampling in jitterSample: after the usual samples, a pixel goes
+	//on in batches of adaptiveBatch until the standard error of
+	//its mean is below adaptiveThreshold times the mean (+1, so that black
+	//pixels stop too) or it has maxSamples. 0 turns it off.
+	double adaptiveThreshold = 0;
+	int adaptiveBatch = 8;
+	int maxSamples = 512;
+	//of the random streams; the same seed gives the same image
+	uint64_t seed = 0;
+	//numbers of the camera paths, see sampler.h; independent if nullptr
+	const Sampler* sampler = nullptr;
+};
+
+//Counters of a render, gathered per thread and summed afterwards
+struct RenderStats
+{
+	long long paths = 0;
+	long long segments = 0;	//rays traced, the primary one included
+
+	void Add(const RenderStats& s)
+	{
+		paths += s.paths;
+		segments += s.segments;
+	}
+	double AveragePathLength() const
+	{
+		return paths ? (double)segments / paths : 0;
+	}
+};
+
+//Running mean and variance of a sequence (Welford's method)
+struct RunningStats
+{
+	long long n = 0;
+	double mean = 0;
+	double m2 = 0;
+
+	void Add(double x)
+	{
+		n++;
+		double delta = x - mean;
+		mean += delta / n;
+		m2 += delta * (x - mean);
+	}
+	double Variance() const
+	{
+		return n > 1 ? m2 / (n - 1) : 0;
+	}
+	//of the mean
+	double StandardError() const
+	{
+		return n > 1 ? sqrt(Variance() / n) : InfinityDouble;
+	}
+};
+
+//State carried from one bounce to the next instead of on the call stack
+struct PathState
+{
+	Ray ray;
+	Color throughput;	//filter applied to light entering the path here, 255 = 1
+	Color L;			//radiance gathered so far
+	int depth;
+	double pdf;			//density of ray's direction over the angle, 0 if a specular scatter picked it
+	Material* scatterer;	//medium that picked ray's direction, nullptr for a uniform pick
+	Vector2d wo;		//direction that arrived at the scatterer
+	bool skipEmission;	//the next hit's emission is accounted for elsewhere
+	bool specular;		//every scatter so far was specular
+	MediumStack media;	//objects ray.o is inside, filled by tracePath
+
+	PathState(const Ray& r, int d = 0)
+		:ray(r), throughput(255, 255, 255), L(0, 0, 0), depth(d), pdf(0), scatterer(nullptr),
+		skipEmission(false), specular(true) {}
+
+	//density with which the vertex at ray.o would have picked d
+	double scatterPdf(const Vector2d& d) const
+	{
+		return scatterer ? materialPdf(scatterer, wo, d) : Inv_2PI;
+	}
+};
+
+//Power heuristic with beta = 2
+inline double powerHeuristic(double fPdf, double gPdf)
+{
+	double f = fPdf * fPdf, g = gPdf * gPdf;
+	return f + g > 0 ? f / (f + g) : 0;
+}
+
+//Next-event estimation at the vertex path->ray.o: radiance of one light
+//sample, weighted against the vertex picking the same direction itself.
+//The throughput still has to be applied.
+Color sampleDirect(const PathState& path, Scene& s, RandomStream& rng)
+{
+	const Point2d& p = path.ray.o;
+	Vector2d d;
+	double lightPdf;
+	double u1 = rng.uniform_0_to_1(), u2 = rng.uniform_0_to_1();
+	Object* light = s.SampleLight(p, u1, u2, &d, &lightPdf);
+	if (!light) return Color(0, 0, 0);
+
+	//the angle of a bounding box can be wider than the light
+	Interaction lightRec;
+	if (!light->Intersect(Ray(p, d), &lightRec))
+		return Color(0, 0, 0);
+	//a boundary crossed on the way, not one around p: IntersectP is also
+	//true inside any object, the medium p is in for one
+	Interaction blocker;
+	if (s.Intersect(Ray(p, d, lightRec.t * (1 - 0.0001)), &blocker))
+		return Color(0, 0, 0);
+
+	double scatterPdf = path.scatterPdf(d);
+	return materialLi(light->material) * (scatterPdf * powerHeuristic(lightPdf, scatterPdf) / lightPdf);
+}
+
+//Follows path until it escapes, stops scattering, loses the roulette or
+//reaches settings.maxDepth. hitted tells whether inte already holds the
+//hit of path->ray. The vertex at depth d draws from bounce d + 1 of rng,
+//each decision from its own dimension; bounce 0 is left to whoever made
+//the first ray.
+void tracePath(PathState* path, Interaction* inte, Scene& s, bool hitted, RandomStream& rng,
+	const RenderSettings& settings, RenderStats* stats)
+{
+	if (stats)
+		stats->paths++;
+	s.Enclosing(path->ray.o, &path->media);
+	while (true)
+	{
+		if (stats)
+			stats->segments++;
+		bool nee = settings.nee && path->pdf > 0;
+		if (nee)
+		{
+			rng.Bounce(path->depth + 1, LightDimension);
+			path->L += sampleDirect(*path, s, rng) * path->throughput;
+		}
+		bool caustic = settings.causticPhotons && path->depth > 0 && path->specular;
+		if (!hitted)
+		{
+			if (!caustic)
+				path->L += Background * path->throughput;
+			return;
+		}
+#ifdef DEBUG
+		drawLine(debug, path->ray.o, inte->p);
+#endif //DEBUG
+		const Ray& r = path->ray;
+		Color Le = (path->skipEmission || caustic) ? Color(0, 0, 0) : materialLi(inte->mat);
+		path->skipEmission = false;
+		//the light could have been sampled from r.o too
+		if (nee && inte->mat->isLight)
+			Le *= powerHeuristic(path->pdf, s.LightPdf(r.o, inte->object, r.d));
+		path->L += Le * path->throughput;
+		inte->dis = Distance(r.o, inte->p) * /*3.527777778 **/ 0.001;
+
+		Ray scattered;
+		Color attenuation(255, 255, 255);
+		double transmittance;
+		rng.Bounce(path->depth + 1, ScatterDimension);
+		if (path->depth >= settings.maxDepth || !materialScattered(inte->mat, r, *inte, &attenuation, &scattered, &transmittance, rng))
+			return;
+
+		path->throughput = path->throughput * attenuation;
+		if (inte->mat->isMedium)
+			path->throughput *= transmittance;
+		else if (Object* inside = path->media.overflowed ? s.Containing(r.o) : path->media.Top())
+			path->throughput *= beerLambert(inside->absorption, inte->dis);
+		path->media.Cross(*inte, scattered);
+
+		double survival = path->throughput.MaxComponent() / 255;
+		if (path->depth + 1 >= settings.rrMinDepth && survival < settings.rrThreshold)
+		{
+			rng.Bounce(path->depth + 1, RouletteDimension);
+			if (survival <= 0 || rng.uniform_0_to_1() >= survival)
+				return;
+			path->throughput /= survival;
+		}
+
+		path->pdf = materialPdf(inte->mat, r.d, scattered.d);
+		path->scatterer = path->pdf > 0 ? inte->mat : nullptr;
+		path->specular = path->specular && path->pdf == 0;
+		path->wo = r.d;
+		path->ray = scattered;
+		path->depth++;
+		hitted = s.Intersect(path->ray, inte);
+	}
+}
+
+//Total radiance arriving along r
+Color trace(const Ray& r, Interaction* inte, Scene& s, RandomStream& rng, int depth = 0,
+	const RenderSettings& settings = RenderSettings(), RenderStats* stats = nullptr)
+{
+	PathState path(r, depth);
+	tracePath(&path, inte, s, s.Intersect(r, inte), rng, settings, stats);
+	return path.L;
+}
+//Ray from p in the direction of dimension 0 of bounce 0, uniform over the
+//circle as tracePixel wants it
+Ray cameraRay(const Point2d& p, RandomStream& rng)
+{
+	rng.Bounce(0);
+	double theta = PI * 2 * rng.uniform_0_to_1();
+	return Ray(p, cos(theta), sin(theta));
+}
+//Radiance arriving at r.o along r, where r.d was drawn uniformly over the
+//circle, so lights can be sampled from r.o as well. With settings.direct
+//the emission of the first hit is left to the caller.
+//hitted tells whether inte already holds the hit of r, e.g. from a packet.
+Color tracePixel(const Ray& r, Interaction* inte, bool hitted, Scene& s, RandomStream& rng,
+	const RenderSettings& settings = RenderSettings(), RenderStats* stats = nullptr)
+{
+	PathState path(r);
+	path.pdf = settings.direct ? 0 : Inv_2PI;
+	path.skipEmission = settings.direct != nullptr;
+	tracePath(&path, inte, s, hitted, rng, settings, stats);
+	return path.L;
+}
+Color tracePixel(const Ray& r, Interaction* inte, Scene& s, RandomStream& rng,
+	const RenderSettings& settings = RenderSettings(), RenderStats* stats = nullptr)
+{
+	return tracePixel(r, inte, s.Intersect(r, inte), s, rng, settings, stats);
+}
+//tracePixel for n rays from p, ray k drawn by cameraRay from stream(k);
+//calls result(k, L) for each. Sorted by angle, rays close enough to each
+//other find their first hits a packet at a time, and a ray with no
+//neighbour within MaxPacketSpread is traced on its own. Past the first
+//hit every path goes its own way.
+template <typename S, typename F>
+void tracePixelRays(const Point2d& p, int n, Scene& s, S stream, const RenderSettings& settings, RenderStats* stats,
+	F result)
+{
+	std::vector<std::pair<double, int>> order(n);
+	std::vector<Vector2d> d(n);
+	for (int k = 0; k < n; k++)
+	{
+		RandomStream rng = stream(k);
+		d[k] = cameraRay(p, rng).d;
+		order[k] = std::make_pair(atan2(d[k].y, d[k].x), k);
+	}
+	std::sort(order.begin(), order.end());
+
+	for (int i = 0; i < n;)
+	{
+		int j = i + 1;
+		while (j < n && j - i < PacketSize && order[j].first - order[i].first <= MaxPacketSpread)
+			j++;
+
+		if (j - i == 1)
+		{
+			int k = order[i].second;
+			RandomStream rng = stream(k);
+			Interaction inte;
+			result(k, tracePixel(Ray(p, d[k]), &inte, s, rng, settings, stats));
+		}
+		else
+		{
+			RayPacket packet(p);
+			for (int m = i; m < j; m++)
+				packet.Add(d[order[m].second]);
+			Interaction inte[PacketSize];
+			unsigned hitted = s.IntersectPacket(packet, inte);
+			for (int m = i; m < j; m++)
+			{
+				int k = order[m].second;
+				RandomStream rng = stream(k);
+				result(k, tracePixel(packet.ray(m - i), &inte[m - i], (hitted >> (m - i)) & 1, s, rng, settings, stats));
+			}
+		}
+		i = j;
+	}
+}
+//radiance leaving the hit inte back along r, including the path continued from it
+Color shade(const Ray& r, Interaction* inte, Scene& s, RandomStream& rng, int depth = 0,
+	const RenderSettings& settings = RenderSettings(), RenderStats* stats = nullptr)
+{
+	PathState path(r, depth);
+	tracePath(&path, inte, s, true, rng, settings, stats);
+	return path.L;
+}
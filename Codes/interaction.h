@@ -2,6 +2,8 @@
 #include"geometry.h"
 #include"material.h"
 
+class Object;
+
 class Interaction
 {
 public:
@@ -11,6 +13,7 @@ public:
 	Vector2d n;
 	Vector2d wo;
 	Material* mat;
+	Object* object = nullptr;	//object that was hit
 	double dis;
 	
 
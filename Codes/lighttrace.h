@@ -0,0 +1,270 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"color.h"
+#include"svimg.h"
+#include"random.h"
+#include"object.h"
+#include"material.h"
+#include"integrator.h"
+#include<algorithm>
+#include<omp.h>
+
+//Light tracing.
+//Particles leave the lights and bounce with the same scattered() the
+//camera paths use. A pixel shows the radiance averaged over directions,
+//i.e. the fluence over 2PI, and the fluence in a pixel is the length of
+//particle track crossing it times the particle weight, per unit area.
+//Light focused by a Refractor is found by every particle that takes the
+//path, where gathering from the pixel needs to hit the light by chance.
+
+//Adds weight times the length of the segment from a to b that crosses each
+//pixel, attenuated by exp(-sigma * distance from a). Pixel (x, y) covers
+//[x - 0.5, x + 0.5) x [y - 0.5, y + 0.5).
+void splatSegment(std::vector<Color>& buffer, int w, int h, const Point2d& a, const Point2d& b,
+	const Color& weight, double sigma)
+{
+	Vector2d d = b - a;
+	double len = d.Length();
+	if (len <= 0) return;
+	d = d / len;
+	Point2d o(a.x + 0.5, a.y + 0.5);
+
+	//clip to the image
+	double s0 = 0, s1 = len;
+	for (int k = 0; k < 2; k++)
+	{
+		double hi = k == 0 ? w : h;
+		if (d[k] == 0)
+		{
+			if (o[k] < 0 || o[k] >= hi) return;
+			continue;
+		}
+		double t0 = -o[k] / d[k], t1 = (hi - o[k]) / d[k];
+		if (t0 > t1) std::swap(t0, t1);
+		s0 = std::max(s0, t0);
+		s1 = std::min(s1, t1);
+	}
+	if (s0 >= s1) return;
+
+	//walk the pixels along the segment
+	Point2d p = o + d * s0;
+	int x = std::min(std::max((int)floor(p.x), 0), w - 1);
+	int y = std::min(std::max((int)floor(p.y), 0), h - 1);
+	int stepX = d.x > 0 ? 1 : -1, stepY = d.y > 0 ? 1 : -1;
+	double nextX = d.x != 0 ? ((d.x > 0 ? x + 1 : x) - o.x) / d.x : InfinityDouble;
+	double nextY = d.y != 0 ? ((d.y > 0 ? y + 1 : y) - o.y) / d.y : InfinityDouble;
+	double deltaX = d.x != 0 ? fabs(1 / d.x) : InfinityDouble;
+	double deltaY = d.y != 0 ? fabs(1 / d.y) : InfinityDouble;
+
+	double s = s0;
+	while (s < s1)
+	{
+		double next = std::min(std::min(nextX, nextY), s1);
+		double length = sigma > 0 ? (exp(-sigma * s) - exp(-sigma * next)) / sigma : next - s;
+		buffer[y * w + x] += weight * length;
+		s = next;
+		if (nextX < nextY)
+		{
+			x += stepX;
+			nextX += deltaX;
+		}
+		else
+		{
+			y += stepY;
+			nextY += deltaY;
+		}
+		if (x < 0 || x >= w || y < 0 || y >= h) break;
+	}
+}
+
+//Where particles start: the lights that can sample their boundary, both
+//sides, and Background from a circle around the image and everything
+//bounded in the scene. Emitters are picked in proportion to their power.
+class ParticleEmitter
+{
+public:
+	Point2d centre;	//of the background circle
+	double radius;
+
+	ParticleEmitter(Scene& s, const Bounds2d& image) :total(0)
+	{
+		for (auto& i : s.scene_list)
+		{
+			Point2d p;
+			Vector2d n;
+			double length;
+			if (!i->material->isLight || !i->surface->SampleBoundary(0, &p, &n, &length))
+				continue;
+			lights.push_back(i);
+			total += materialLi(i->material).MaxComponent() * 4 * length;
+			cdf.push_back(total);
+		}
+		Bounds2d sceneBounds = image;
+		for (auto& i : s.scene_list)
+		{
+			Bounds2d b = i->surface->WorldBound();
+			if (b.IsFinite() && !b.IsEmpty())
+				sceneBounds = Union(sceneBounds, b);
+		}
+		centre = sceneBounds.Centroid();
+		radius = sceneBounds.Diagonal().Length() * 0.5 + 1;
+		total += Background.MaxComponent() * 2 * 2 * PI * radius;
+		cdf.push_back(total);
+	}
+
+	//Starts one of particles particles: r leaves the emitter, weight is the
+	//power it carries. False if nothing emits.
+	bool Sample(int particles, RandomStream& rng, Ray* r, Color* weight) const
+	{
+		if (total <= 0) return false;
+		int e = (int)(std::lower_bound(cdf.begin(), cdf.end(), rng.uniform_0_to_1() * total) - cdf.begin());
+		e = std::min(e, (int)cdf.size() - 1);
+		double pick = (cdf[e] - (e ? cdf[e - 1] : 0)) / total;
+		Point2d p;
+		Vector2d n;
+		double length;
+		Color Le(0, 0, 0);
+		double sides;
+		if (e < (int)lights.size())
+		{
+			lights[e]->surface->SampleBoundary(rng.uniform_0_to_1(), &p, &n, &length);
+			Le = materialLi(lights[e]->material);
+			sides = 2;
+			if (rng.uniform_0_to_1() < 0.5) n = -n;
+		}
+		else
+		{
+			double theta = 2 * PI * rng.uniform_0_to_1();
+			n = -Vector2d(cos(theta), sin(theta));
+			p = centre - n * radius;
+			length = 2 * PI * radius;
+			Le = Background;
+			sides = 1;
+		}
+		//cosine-weighted around n
+		double sinTheta = rng.uniform_Minus1_to_1();
+		double cosTheta = sqrt(std::max(0.0, 1 - sinTheta * sinTheta));
+		*r = Ray(p + 0.001 * n, n * cosTheta + Vector2d(-n.y, n.x) * sinTheta);
+		*weight = Le * (2 * sides * length / (pick * particles));
+		return true;
+	}
+
+private:
+	std::vector<Object*> lights;
+	std::vector<double> cdf;
+	double total;
+};
+
+//A straight piece of a particle's path
+struct ParticleSegment
+{
+	Point2d a, b;
+	Color weight;		//power at a
+	double sigma;		//attenuation per unit length from a on
+	int depth;			//scatters before a
+	bool specular;		//all of them specular
+
+	ParticleSegment() :weight(0, 0, 0), sigma(0), depth(0), specular(true) {}
+};
+
+//Follows one particle from emitter, calling segment(seg) for every piece
+//of its path; segment returns false to stop the particle there. Emission
+//draws from bounce 0 of rng, the piece after the d-th scatter from d + 1.
+template <typename F>
+int traceParticle(Scene& s, const ParticleEmitter& emitter, int particles, RandomStream& rng,
+	const RenderSettings& settings, F segment)
+{
+	ParticleSegment seg;
+	Ray r;
+	rng.Bounce(0);
+	if (!emitter.Sample(particles, rng, &r, &seg.weight))
+		return 0;
+	double initial = seg.weight.MaxComponent();
+	double sigmaMedium = -1;
+	int segments = 0;
+	while (true)
+	{
+		segments++;
+		rng.Bounce(seg.depth + 1, ScatterDimension);
+		Interaction inte;
+		bool hitted = s.Intersect(r, &inte);
+		seg.a = r.o;
+		seg.b = hitted ? inte.p : r.o + r.d * (emitter.radius * 2 + Distance(r.o, emitter.centre));
+
+		//camera paths do not attenuate the emission they hit
+		seg.sigma = 0;
+		if (seg.depth > 0)
+		{
+			if (sigmaMedium >= 0)
+				seg.sigma = sigmaMedium * 0.001;
+			else if (Object* inside = s.Containing(seg.a + (seg.b - seg.a) * 0.5))
+				seg.sigma = inside->absorption * 0.001;
+		}
+		if (!segment(seg) || !hitted || inte.mat->isLight || seg.depth >= settings.maxDepth)
+			break;
+
+		Ray scattered;
+		Color attenuation(255, 255, 255);
+		double transmittance = 1.0;
+		inte.dis = Distance(r.o, inte.p) * 0.001;
+		if (!materialScattered(inte.mat, r, inte, &attenuation, &scattered, &transmittance, rng))
+			break;
+		seg.weight *= exp(-seg.sigma * Distance(seg.a, seg.b));
+		seg.weight = seg.weight * attenuation;
+		sigmaMedium = (inte.mat->isMedium && inte.dis > 0 && transmittance > 0) ? -log(transmittance) / inte.dis : -1;
+		seg.specular = seg.specular && materialPdf(inte.mat, r.d, scattered.d) == 0;
+
+		double survival = seg.weight.MaxComponent() / initial;
+		if (seg.depth + 1 >= settings.rrMinDepth && survival < settings.rrThreshold)
+		{
+			rng.Bounce(seg.depth + 1, RouletteDimension);
+			if (survival <= 0 || rng.uniform_0_to_1() >= survival)
+				break;
+			seg.weight /= survival;
+		}
+		r = scattered;
+		seg.depth++;
+	}
+	return segments;
+}
+
+//Renders img from particles particles
+void lightTrace(Image& img, Scene& s, int particles, const RenderSettings& settings, RenderStats* stats)
+{
+	const int w = img.fullResolution.x;
+	const int h = img.fullResolution.y;
+	ParticleEmitter emitter(s, Bounds2d(Point2d(-0.5, -0.5), Point2d(w - 0.5, h - 0.5)));
+
+	int nThreads = omp_get_max_threads();
+	std::vector<std::vector<Color>> buffers(nThreads, std::vector<Color>(w * h, Color(0, 0, 0)));
+
+	long long paths = 0, segments = 0;
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+:paths,segments)
+	for (int k = 0; k < particles; k++)
+	{
+		std::vector<Color>& buffer = buffers[omp_get_thread_num()];
+		RandomStream rng = RandomStream(k, 0, settings.seed).Child(ParticleStreams);
+		paths++;
+		segments += traceParticle(s, emitter, particles, rng, settings, [&](const ParticleSegment& seg) {
+			splatSegment(buffer, w, h, seg.a, seg.b, seg.weight, seg.sigma);
+			return true;
+		});
+	}
+	if (stats)
+	{
+		stats->paths += paths;
+		stats->segments += segments;
+	}
+
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+		{
+			Color c(0, 0, 0);
+			for (auto& b : buffers)
+				c += b[y * w + x];
+			c *= Inv_2PI;
+			c = Color(std::min(c.r, 255.0), std::min(c.g, 255.0), std::min(c.b, 255.0));
+			img.setPixel(Point2i(x, y), sqrtColor(c));
+		}
+}
@@ -0,0 +1,177 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"color.h"
+#include"svimg.h"
+#include"random.h"
+#include"object.h"
+#include"integrator.h"
+
+//Line-sweep rendering.
+//Every point on a straight line, looking along it, sees the same sequence
+//of boundary crossings. So instead of tracing N rays from every pixel, we
+//cast N families of parallel lines through the image, find the crossings
+//of each line once, and let all the pixels on the line share them.
+
+//Keeps a line that starts inside a degenerate hit from stalling
+const int MaxLineCrossings = 4096;
+//past a crossing before looking for the next, as small as finds it no more
+const double LineStep = 0.001;
+
+//A boundary crossing on a swept line.
+struct LineCrossing
+{
+	double t;			//distance along the line
+	Color emission;		//Li() of the crossed surface
+	Color scattered;	//radiance of the path continued from the crossing
+	double sigma;		//extinction over the segment ending at the crossing (per unit of Interaction::dis)
+
+	LineCrossing() :t(0), emission(0, 0, 0), scattered(0, 0, 0), sigma(0) {}
+};
+
+//Collects the crossings met by a ray from o along d, up to and including
+//the first one beyond tEnd. Crossing k continues its path with line.Child(k).
+void sweepCrossings(const Point2d& o, const Vector2d& d, double tEnd, Scene& s, std::vector<LineCrossing>* crossings,
+	const RandomStream& line, const RenderSettings& settings, RenderStats* stats)
+{
+	crossings->clear();
+	double t0 = 0;
+	for (int k = 0; k < MaxLineCrossings; k++)
+	{
+		Ray r(o + d * t0, d);
+		Interaction inte;
+		if (!s.Intersect(r, &inte))
+			break;
+		//the surface reports a hit at the origin itself, step just past it
+		//so that thin geometry beyond is not skipped
+		if (inte.t < EPSILON)
+		{
+			t0 += inte.t + LineStep;
+			if (t0 > tEnd) break;
+			continue;
+		}
+
+		LineCrossing c;
+		double t1 = t0 + inte.t;
+		c.t = t1;
+		c.emission = materialLi(inte.mat);
+
+		Ray scattered;
+		Color attenuation(0, 0, 0);
+		double transmittance = 1.0;
+		inte.dis = Distance(r.o, inte.p) * 0.001;
+		RandomStream rng = line.Child(crossings->size());
+		rng.Bounce(1, ScatterDimension);
+		if (materialScattered(inte.mat, r, inte, &attenuation, &scattered, &transmittance, rng))
+		{
+			Interaction next;
+			c.scattered = trace(scattered, &next, s, rng, 1, settings, stats) * attenuation;
+			//Beer-Lambert is exponential in dis, so one coefficient serves
+			//every pixel on the segment whatever its distance to the crossing
+			if (inte.mat->isMedium)
+				c.sigma = (inte.dis > 0 && transmittance > 0) ? -log(transmittance) / inte.dis : 0;
+			else if (Object* inside = s.Containing(o + d * (0.5 * (t0 + t1))))
+				c.sigma = inside->absorption;
+		}
+		crossings->push_back(c);
+
+		if (t1 > tEnd) break;
+		t0 = t1 + LineStep;
+	}
+}
+
+//Renders img with samples line families over [0, 2PI).
+//Lines of a family are one pixel apart along the minor axis and visit one
+//pixel per step along the major axis, so each pixel gets exactly one
+//sample per family.
+void lineSweep(Image& img, Scene& s, int samples, const RenderSettings& settings, RenderStats* stats)
+{
+	const int w = img.fullResolution.x;
+	const int h = img.fullResolution.y;
+	std::vector<Color> sum(w * h, Color(0, 0, 0));
+
+	for (int n = 0; n < samples; n++)
+	{
+		RandomStream family = RandomStream(0, n, settings.seed).Child(LineStreams);
+		double theta = PI * 2 * (n + family.uniform_0_to_1()) / samples;
+		Vector2d d(cos(theta), sin(theta));
+
+		int major = fabs(d.x) >= fabs(d.y) ? 0 : 1;
+		int minor = 1 - major;
+		int majorRes = major == 0 ? w : h;
+		int minorRes = major == 0 ? h : w;
+		double slope = d[minor] / d[major];
+		double step = 1 / fabs(d[major]);
+		int dir = d[major] > 0 ? 1 : -1;
+		double jitter = family.uniform_0_to_1() - 0.5;
+
+		//line j runs through minor = j + jitter + slope * major
+		double drift = slope * (majorRes - 1);
+		int jMin = (int)floor(std::min(0.0, -drift)) - 1;
+		int jMax = minorRes + (int)ceil(std::max(0.0, -drift)) + 1;
+
+		long long paths = 0, segments = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:paths,segments)
+		for (int j = jMin; j < jMax; j++)
+		{
+			RenderStats lineStats;
+			//in-image part of the line, in travel order
+			int first = -1, last = -1;
+			for (int m = 0; m < majorRes; m++)
+			{
+				int x = dir > 0 ? m : majorRes - 1 - m;
+				int y = (int)floor(j + jitter + slope * x + 0.5);
+				if (y >= 0 && y < minorRes)
+				{
+					if (first < 0) first = m;
+					last = m;
+				}
+			}
+			if (first < 0) continue;
+
+			int x0 = dir > 0 ? first : majorRes - 1 - first;
+			Point2d o;
+			o[major] = x0;
+			o[minor] = j + jitter + slope * x0;
+
+			std::vector<LineCrossing> crossings;
+			sweepCrossings(o, d, (last - first) * step, s, &crossings, family.Child(j - jMin), settings, &lineStats);
+			paths += lineStats.paths;
+			segments += lineStats.segments;
+
+			size_t k = 0;
+			for (int m = first; m <= last; m++)
+			{
+				int x = dir > 0 ? m : majorRes - 1 - m;
+				int y = (int)floor(j + jitter + slope * x + 0.5);
+				double t = (m - first) * step;
+				while (k < crossings.size() && crossings[k].t <= t)
+					k++;
+
+				Color c = Background;
+				if (k < crossings.size())
+				{
+					const LineCrossing& hit = crossings[k];
+					c = hit.emission + hit.scattered * beerLambert(hit.sigma, (hit.t - t) * 0.001);
+				}
+				int px = major == 0 ? x : y;
+				int py = major == 0 ? y : x;
+				sum[py * w + px] += c;
+			}
+		}
+		if (stats)
+		{
+			stats->paths += paths;
+			stats->segments += segments;
+		}
+	}
+
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+		{
+			Color c = sum[y * w + x];
+			c /= samples;
+			c = Color(std::min(c.r, 255.0), std::min(c.g, 255.0), std::min(c.b, 255.0));
+			img.setPixel(Point2i(x, y), sqrtColor(c));
+		}
+}
@@ -1,96 +1,65 @@
+//#define DEBUG
+
 #include"header.h"
 #include"geometry.h"
 #include"color.h"
 #include"utilities.h"
 #include"surface.h"
+#include"staticcsg.h"
+#include"mesh.h"
+#include"bezier.h"
+#include"instance.h"
 #include"svimg.h"
 #include"random.h"
 #include"object.h"
 #include"material.h"
+#include"integrator.h"
+#include"linesweep.h"
+#include"cascades.h"
+#include"direct.h"
+#include"lighttrace.h"
+#include"photonmap.h"
+#include"progressive.h"
+#include"sampler.h"
 
 #include<omp.h>
 
-//#define DEBUG
-
 const int W = 450;
 const int H = 450;
 const int N = 32;
-const int DEPTH = 50;
-
-Image i(Point2i(W, H), "asd");
-Image debug(Point2i(W, H), "debug");
-
-
+const int PARTICLES = W * H * 4;
 
-void drawLine(Image& img, const Point2d& p1, const Point2d& p2)
+enum class RenderMode
 {
-
-	int dx = p2.x - p1.x, dy = p2.y - p1.y, steps, k;
-	float xIncrement, yIncrement, x = p1.x, y = p1.y;
-
-	if (fabs(dx) > fabs(dy))
-		steps = fabs(dx);
-	else
-		steps = fabs(dy);
-
-	xIncrement = float(dx) / float(steps);
-	yIncrement = float(dy) / float(steps);
-
-	img.setPixel(Point2i(round(x), round(y)), Color(255, 0, 0));
-	for (k = 0; k < steps; k++) {
-		x += xIncrement;
-		y += yIncrement;
-
-		//if (y >= H)y = H - 1;
-		//else if (y < 0)y = 0;
-
-		//if (x >= W)x = W - 1;
-		//else if (x < 0)x = 0;
-
-
-		img.setPixel(Point2i(round(x), round(y)), Color(255, 0, 0));
-	}
-}
-//ͨݹȡrϵܹ
-Color trace(const Ray& r, Interaction* inte, Scene& s, int depth = 0)
+	Jitter,		//N jittered rays per pixel
+	LineSweep,	//N line families shared by all the pixels they cross
+	Cascades,	//radiance cascades, noise-free preview
+	Direct,		//exact direct light only, no bounces
+	LightTrace,	//PARTICLES particles from the lights, for caustics
+	PhotonMap,	//N jittered rays per pixel, caustics from progressive photon mapping
+	Progressive,	//passes of jittered rays until TIME_BUDGET runs out, the image written after each
+	Convergence	//prints the error of SAMPLER at 1 to 1024 samples per pixel, no image
+};
+const RenderMode MODE = RenderMode::Jitter;
+enum class SamplerType
 {
+	Independent,
+	Stratified,
+	Halton,
+	Sobol
+};
+const SamplerType SAMPLER = SamplerType::Stratified;
+const double TIME_BUDGET = 60;	//seconds, for RenderMode::Progressive
 
-	if (s.Intersect(r, inte))
-	{
-#ifdef DEBUG
-		drawLine(debug, r.o, inte->p);
-#endif DEBUG
-		Ray scattered;
-		Color attenuation(0, 0, 0);
-		double absorb = 1.0;
-		double transmittance;
-		Color sum = inte->mat->Li();
-		Interaction inte_temp;
-
-		inte->dis = Distance(r.o, inte->p) * /*3.527777778 **/ 0.001;
-
+Image i(Point2i(W, H), "asd");
+Image debug(Point2i(W, H), "debug");
 
-		if (inte->mat->isMedium)
-		{
-			if (depth < DEPTH && inte->mat->scattered(r, *inte, &attenuation, &scattered,&transmittance))
-				sum += trace(scattered, inte, s, depth + 1) * absorb*transmittance;
-		}
-		else if (depth < DEPTH && inte->mat->scattered(r, *inte, &attenuation, &scattered, &transmittance))
-		{
-			if (s.isInside(r))
-			{
-				absorb = beerLambert(0.34f, inte->dis);
-			}
-			sum += trace(scattered, inte, s, depth + 1) * absorb;
-		}
-		return sum;
-	}
-	else
-		return Color(6, 6, 6);
-}
 
 //ֲ㶶
-Color jitterSample(const Point2d & p, Scene & s, int samples)
+//taken receives the number of samples spent, which can exceed samples with
+//adaptive sampling
+Color jitterSample(const Point2d & p, Scene & s, int samples, const RenderSettings& settings, RenderStats* stats,
+	int* taken = nullptr)
 {
 	Color c(0, 0, 0);
 #ifdef DEBUG 
@@ -100,14 +69,34 @@ Color jitterSample(const Point2d & p, Scene & s, int samples)
 	}
 #endif DEBUG
 
-	for (int n = 0; n < N; n++)
+	//The spread of single samples overstates the error of a stratified or
+	//low-discrepancy mean, which errs on the safe side.
+	bool adaptive = settings.adaptiveThreshold > 0;
+	int batch = adaptive ? settings.adaptiveBatch : samples;
+	RunningStats error;
+	int count = 0;
+	while (true)
 	{
-		Interaction inte;
-		Ray r = Ray(Point2d(p.x, p.y), cosf(PI * 2 * (n + real_rand_uniform_Minus1_to_1()) / samples), sinf(PI * 2 * (n + real_rand_uniform_Minus1_to_1()) / N));
-		//Ray r = Ray(Point2d(p.x, p.y),sample_in_unit_disk());
-		c += trace(r, &inte, s);
+		Color sum(0, 0, 0);
+		//the sampler spreads the angles over the samples
+		auto stream = [&](int n) {
+			return RandomStream((int)p.y * W + (int)p.x, count + n, settings.seed, settings.sampler);
+		};
+		tracePixelRays(p, batch, s, stream, settings, stats, [&](int n, const Color& L) {
+			sum += L;
+			error.Add((L.r + L.g + L.b) / 3);
+		});
+		c += sum;
+		count += batch;
+
+		if (count < samples) continue;
+		if (!adaptive || count >= settings.maxSamples) break;
+		if (error.StandardError() <= settings.adaptiveThreshold * (error.mean + 1)) break;
 	}
-	c /= samples;
+	if (taken) *taken = count;
+	c /= count;
+	if (settings.direct)
+		c += settings.direct->Li(p);
 	c = Color(std::min(c.r, 255.0), std::min(c.g, 255.0), std::min(c.b, 255.0));
 
 	c = sqrtColor(c);
@@ -160,33 +149,34 @@ int main()
 	Disk light_l(Point2d(90, 70), 57);
 	Disk light_r(Point2d(100, 330), 57);
 
-	ShapeIntersect line(
-		new ShapeIntersect(new HalfPlane(-1, 0, 70), new HalfPlane(1, 0, -14)),
-		new ShapeIntersect(new HalfPlane(0, 1, -125), new HalfPlane(0, -1, 189)));
+	//the fixed shapes are static CSG, inlined whole (see staticcsg.h)
+	auto line = staticIntersect(
+		staticIntersect(HalfPlane(-1, 0, 70), HalfPlane(1, 0, -14)),
+		staticIntersect(HalfPlane(0, 1, -125), HalfPlane(0, -1, 189)));
 
-	ShapeIntersect reflect1(
-		new ShapeIntersect(new HalfPlane(-1, 0, 130), new HalfPlane(1, 0, -30)),
-		new ShapeIntersect(new HalfPlane(0, 1, -150), new HalfPlane(0, -1, 220)));
+	auto reflect1 = staticIntersect(
+		staticIntersect(HalfPlane(-1, 0, 130), HalfPlane(1, 0, -30)),
+		staticIntersect(HalfPlane(0, 1, -150), HalfPlane(0, -1, 220)));
 
-	ShapeIntersect reflect2(
-		new ShapeIntersect(new HalfPlane(-1, 0, 250), new HalfPlane(1, 0, -170)),
-		new ShapeIntersect(new HalfPlane(0, 1, -180), new HalfPlane(0, -1, 270)));
+	auto reflect2 = staticIntersect(
+		staticIntersect(HalfPlane(-1, 0, 250), HalfPlane(1, 0, -170)),
+		staticIntersect(HalfPlane(0, 1, -180), HalfPlane(0, -1, 270)));
 
-	ShapeIntersect boxCenter(
-		new ShapeIntersect(new HalfPlane(-1, 0, 290), new HalfPlane(1, 0, -150)),
-		new ShapeIntersect(new HalfPlane(0, 1, -150), new HalfPlane(0, -1, 290)));
+	auto boxCenter = staticIntersect(
+		staticIntersect(HalfPlane(-1, 0, 290), HalfPlane(1, 0, -150)),
+		staticIntersect(HalfPlane(0, 1, -150), HalfPlane(0, -1, 290)));
 
-	ShapeIntersect convexLens(
-		new ShapeIntersect(
-			new ShapeIntersect(new HalfPlane(-1, 0, 390), new HalfPlane(1, 0, -60)),
-			new ShapeIntersect(new HalfPlane(0, 1, -165), new HalfPlane(0, -1, 390))),
-		new Disk(Point2d(225, 168), 126));
+	auto convexLens = staticIntersect(
+		staticIntersect(
+			staticIntersect(HalfPlane(-1, 0, 390), HalfPlane(1, 0, -60)),
+			staticIntersect(HalfPlane(0, 1, -165), HalfPlane(0, -1, 390))),
+		Disk(Point2d(225, 168), 126));
 
-	ShapeUnion boundingBox(
-		new ShapeIntersect(new HalfPlane(1, 0, 450), new HalfPlane(-1, 0, -0)),
-		new ShapeIntersect(new HalfPlane(0, -1, -0), new HalfPlane(0, 1, 450)));
+	auto boundingBox = staticUnion(
+		staticIntersect(HalfPlane(1, 0, 450), HalfPlane(-1, 0, -0)),
+		staticIntersect(HalfPlane(0, -1, -0), HalfPlane(0, 1, 450)));
 
-	ShapeIntersect d4(new Disk(Point2d(220, 226), 60), new Disk(Point2d(220, 274), 60) /*new HalfPlane(0, 1, -220)*/);
+	auto d4 = staticIntersect(Disk(Point2d(220, 226), 60), Disk(Point2d(220, 274), 60) /*HalfPlane(0, 1, -220)*/);
 	//HalfPlane line(0, -1, 125);
 
 	//Disk d4(Point2d(220, 220), 70);
@@ -245,24 +235,83 @@ int main()
 	//s.scene_list.push_back(&refl2);
 	//s.scene_list.push_back(&o_first);
 
+	s.Build();
+
 	//turn on OpenMP to accelerate
+	RenderSettings settings;
+	RenderStats stats;
+	DirectLighting direct(s);
+	//settings.direct = &direct;	//exact direct light in the jittered render
+	//settings.adaptiveThreshold = 0.05;	//more samples where the noise is
+	IndependentSampler independent;
+	StratifiedSampler stratified(N);
+	HaltonSampler halton;
+	SobolSampler sobol;
+	const Sampler* samplers[] = { &independent, &stratified, &halton, &sobol };
+	settings.sampler = samplers[(int)SAMPLER];
+
 	omp_set_nested(1);
-#pragma omp parallel for schedule(dynamic)
-	for (int y = 0; y < H; y++)
-		for (int x = 0; x < W; x++)
+	if (MODE == RenderMode::LineSweep)
+		lineSweep(i, s, N, settings, &stats);
+	else if (MODE == RenderMode::Cascades)
+		RadianceCascades(Point2i(W, H)).Render(i, s, settings, &stats);
+	else if (MODE == RenderMode::Direct)
+		direct.Render(i);
+	else if (MODE == RenderMode::LightTrace)
+		lightTrace(i, s, PARTICLES, settings, &stats);
+	else if (MODE == RenderMode::PhotonMap)
+		photonMapRender(i, s, N, PhotonMapSettings(), settings, &stats);
+	else if (MODE == RenderMode::Progressive)
+	{
+		ProgressiveSettings progressive;
+		progressive.timeBudget = TIME_BUDGET;
+		progressiveRender(i, s, progressive, settings, &stats);
+	}
+	else if (MODE == RenderMode::Convergence)
+		measureConvergence(Point2i(W, H), s, 1024, settings, &stats);
+	else
+	{
+		std::vector<int> taken(W * H, 0);
+		long long paths = 0, segments = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:paths,segments)
+		for (int y = 0; y < H; y++)
 		{
+			RenderStats rowStats;
+			for (int x = 0; x < W; x++)
+			{
 #ifdef DEBUG
-			debug.setPixel(
-				Point2i(x, y),
-				Color(0, 0, 0)
-			);
+				debug.setPixel(
+					Point2i(x, y),
+					Color(0, 0, 0)
+				);
 #endif
-			i.setPixel(
-				Point2i(x, y),
-				jitterSample(Point2d(x, y), s, N)
-			);
+				i.setPixel(
+					Point2i(x, y),
+					jitterSample(Point2d(x, y), s, N, settings, &rowStats, &taken[y * W + x])
+				);
+
+			}
+			paths += rowStats.paths;
+			segments += rowStats.segments;
+		}
+		stats.paths = paths;
+		stats.segments = segments;
 
+		//where the samples went, white = settings.maxSamples
+		if (settings.adaptiveThreshold > 0)
+		{
+			Image sampleMap(Point2i(W, H), "samples");
+			for (int y = 0; y < H; y++)
+				for (int x = 0; x < W; x++)
+				{
+					double v = std::min(255.0 * taken[y * W + x] / settings.maxSamples, 255.0);
+					sampleMap.setPixel(Point2i(x, y), Color(v, v, v));
+				}
+			sampleMap.writeImage();
+			std::cout << "average samples per pixel: " << (double)stats.paths / (W * H) << std::endl;
 		}
+	}
+	std::cout << "average path length: " << stats.AveragePathLength() << std::endl;
 
 	i.writeImage();
 #ifdef DEBUG
@@ -6,6 +6,7 @@
 #include"interaction.h"
 #include "color.h"
 #include"utilities.h"
+#include<typeinfo>
 
 inline Vector2d reflect(const Vector2d& normal, const Vector2d& wo)
 {
@@ -32,25 +33,22 @@ double beerLambert(double absorb, double dis)
 	return exp(-absorb * dis);
 }
 
+//Henyey-Greenstein in 2D (the wrapped Cauchy distribution):
+//density over the angle between the travel directions wo and wi
 double H_G(double g, const Vector2d & wo, const Vector2d & wi)
 {
 	double cosTheta = Dot(Normalize(wo), Normalize(wi));
 
-	return Inv_4PI * (1 - g * g) / (pow(1 + g * g + 2 * g * cosTheta, 1.5));
+	return Inv_2PI * (1 - g * g) / (1 + g * g - 2 * g * cosTheta);
 }
-void sample_H_G(double g, const Vector2d & wo, Vector2d * wi)
+//draws wi from H_G by inverting its CDF at u
+void sample_H_G(double g, const Vector2d & wo, double u, Vector2d * wi)
 {
-	double cosTheta;
-	if (std::abs(g) < 1e-3) //gΪ0ʱǸͬ
-		cosTheta = 1 - 2 * real_rand_uniform_0_to_1();
-	else {
-		double sqrTerm = (1 - g * g) / (1 - g + 2 * g * real_rand_uniform_0_to_1());
-		cosTheta = (1 + g * g - sqrTerm * sqrTerm) / (2 * g);
-	}
-	double sinTheta = std::sqrt(std::max((double)0, 1 - cosTheta * cosTheta));
-
-	*wi = Normalize(Vector2d(wo.x+cosTheta, wo.y+sinTheta));
+	double theta = 2 * atan((1 - g) / (1 + g) * tan(PI * (u - 0.5)));
+	double cosTheta = cos(theta), sinTheta = sin(theta);
+	Vector2d w = Normalize(wo);
 
+	*wi = Vector2d(w.x * cosTheta - w.y * sinTheta, w.x * sinTheta + w.y * cosTheta);
 }
 //bool refract(const Vector2d& v, const Vector2d& n, float ni_over_nt, Vector2d* refracted) {
 //	Vector2d uv = Normalize(v);
@@ -64,15 +62,24 @@ void sample_H_G(double g, const Vector2d & wo, Vector2d * wi)
 //		return false;
 //}
 //
+//the material types materialScattered and the others below call directly
+enum class MaterialKind : unsigned char { Reflector, Refractor, Light, Medium, Other };
+
 class Material
 {
 public:
 	bool isLight;
 	bool isMedium;
+	MaterialKind kind = MaterialKind::Other;	//set by Object::Lower, see materialKind
 	Material(bool light,bool medium) :isLight(light),isMedium(medium) {}
 
 	virtual Color Li() = 0;
-	virtual bool scattered(const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi, double* transmittance) = 0;
+	//rng is the path's stream, set to the current bounce
+	virtual bool scattered(const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi, double* transmittance,
+		RandomStream& rng) = 0;
+	//density of scattered() giving direction wi, over the angle.
+	//0 for specular materials, whose directions cannot be drawn any other way
+	virtual double pdf(const Vector2d& wo, const Vector2d& wi) { return 0; }
 };
 
 
@@ -90,7 +97,8 @@ public:
 	{
 		return Color(0, 0, 0);
 	}
-	virtual bool scattered(const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi, double* transmittance)
+	virtual bool scattered(const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi, double* transmittance,
+		RandomStream& rng)
 	{
 		*attenuation = albedo;
 
@@ -114,8 +122,10 @@ public:
 	{
 		return Color(0, 0, 0);
 	}
-	virtual bool scattered(const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi, double* transmittance)
+	virtual bool scattered(const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi, double* transmittance,
+		RandomStream& rng)
 	{
+		*attenuation = albedo;
 		if (Dot(wo.d, rec.n) > 0)//ڲɢ
 		{
 			Vector2d normal = -rec.n;
@@ -146,6 +156,7 @@ public:
 			//}
 			wi->d = Normalize(wiDir);
 			wi->o = rec.p - 0.01 * normal;
+			return true;
 		}
 		else
 		{
@@ -163,7 +174,7 @@ public:
 
 			double reflQuan = shlick(cosine, ior);
 			//double reflQuan =fo			
-			if (real_rand_uniform_0_to_1() >= reflQuan)
+			if (rng.uniform_0_to_1() >= reflQuan)
 			{
 				wi->d = Normalize(wiDir);
 				wi->o = rec.p - 0.01 * normal;
@@ -192,7 +203,8 @@ public:
 	{
 		return emissivity;
 	}
-	virtual bool scattered(const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi, double* transmittance) { return false; }
+	virtual bool scattered(const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi, double* transmittance,
+		RandomStream& rng) { return false; }
 };
 class Medium :public Material
 {
@@ -212,10 +224,12 @@ public:
 	{
 		return Color(0, 0, 0);
 	}
-	virtual bool scattered(const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi, double* transmittance)
+	virtual bool scattered(const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi, double* transmittance,
+		RandomStream& rng)
 	{
+		*attenuation = Color(255, 255, 255);
 		*transmittance = beerLambert(sigma_s, rec.dis);
-		sample_H_G(g, wo.d, &wi->d);
+		sample_H_G(g, wo.d, rng.uniform_0_to_1(), &wi->d);
 
 		if (Dot(wo.d, rec.n) > 0)
 		{
@@ -230,5 +244,56 @@ public:
 
 		return true;
 	}
+	virtual double pdf(const Vector2d& wo, const Vector2d& wi)
+	{
+		return H_G(g, wo, wi);
+	}
 
 };
+
+//Other for any type but these exact ones, subclasses included, as they may override
+inline MaterialKind materialKind(Material* m)
+{
+	if (typeid(*m) == typeid(Reflector)) return MaterialKind::Reflector;
+	if (typeid(*m) == typeid(Refractor)) return MaterialKind::Refractor;
+	if (typeid(*m) == typeid(Light)) return MaterialKind::Light;
+	if (typeid(*m) == typeid(Medium)) return MaterialKind::Medium;
+	return MaterialKind::Other;
+}
+
+//m->Li(), m->scattered() and m->pdf() through a switch on m->kind, so the
+//integrators' calls can be inlined; a virtual call for MaterialKind::Other
+inline Color materialLi(Material* m)
+{
+	switch (m->kind)
+	{
+	case MaterialKind::Reflector: return ((Reflector*)m)->Reflector::Li();
+	case MaterialKind::Refractor: return ((Refractor*)m)->Refractor::Li();
+	case MaterialKind::Light: return ((Light*)m)->Light::Li();
+	case MaterialKind::Medium: return ((Medium*)m)->Medium::Li();
+	default: return m->Li();
+	}
+}
+inline bool materialScattered(Material* m, const Ray& wo, const Interaction& rec, Color* attenuation, Ray* wi,
+	double* transmittance, RandomStream& rng)
+{
+	switch (m->kind)
+	{
+	case MaterialKind::Reflector: return ((Reflector*)m)->Reflector::scattered(wo, rec, attenuation, wi, transmittance, rng);
+	case MaterialKind::Refractor: return ((Refractor*)m)->Refractor::scattered(wo, rec, attenuation, wi, transmittance, rng);
+	case MaterialKind::Light: return ((Light*)m)->Light::scattered(wo, rec, attenuation, wi, transmittance, rng);
+	case MaterialKind::Medium: return ((Medium*)m)->Medium::scattered(wo, rec, attenuation, wi, transmittance, rng);
+	default: return m->scattered(wo, rec, attenuation, wi, transmittance, rng);
+	}
+}
+inline double materialPdf(Material* m, const Vector2d& wo, const Vector2d& wi)
+{
+	switch (m->kind)
+	{
+	case MaterialKind::Reflector:
+	case MaterialKind::Refractor:
+	case MaterialKind::Light: return m->Material::pdf(wo, wi);
+	case MaterialKind::Medium: return ((Medium*)m)->Medium::pdf(wo, wi);
+	default: return m->pdf(wo, wi);
+	}
+}
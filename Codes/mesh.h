@@ -0,0 +1,226 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"surface.h"
+#include"bvh.h"
+#include<algorithm>
+
+//Outline meshes.
+//Floor plans and CAD outlines come as closed polylines of many segments.
+//A LineMesh keeps their vertices once and the segments as pairs of
+//indices into them; a PolygonMesh is the region they enclose, a Surface
+//with a BVH over the segments of its own. Inside is by the nonzero
+//winding rule, so outlines go counter-clockwise around the inside and
+//clockwise around holes, which AddLoop sees to.
+
+struct LineMesh
+{
+	std::vector<Point2d> p;
+	std::vector<int> vertexIndices;	//two per segment, the inside on its left
+
+	int nSegments() const { return (int)vertexIndices.size() / 2; }
+	const Point2d& a(int i) const { return p[vertexIndices[2 * i]]; }
+	const Point2d& b(int i) const { return p[vertexIndices[2 * i + 1]]; }
+
+	//Adds the closed outline through points, turned counter-clockwise or
+	//clockwise for a hole
+	void AddLoop(const std::vector<Point2d>& points, bool hole = false)
+	{
+		int n = (int)points.size();
+		if (n < 2) return;
+		double area = 0;
+		for (int i = 0; i < n; i++)
+		{
+			const Point2d& u = points[i];
+			const Point2d& v = points[(i + 1) % n];
+			area += u.x * v.y - v.x * u.y;
+		}
+		bool reverse = hole ? area > 0 : area < 0;
+		int first = (int)p.size();
+		for (int i = 0; i < n; i++)
+			p.push_back(points[reverse ? n - 1 - i : i]);
+		for (int i = 0; i < n; i++)
+		{
+			vertexIndices.push_back(first + i);
+			vertexIndices.push_back(first + (i + 1) % n);
+		}
+	}
+};
+
+class PolygonMesh :public Surface
+{
+public:
+	//mesh stays the caller's and may be shared by several PolygonMeshes;
+	//build again whenever it changes
+	PolygonMesh(const LineMesh* mesh) :mesh(mesh) { Build(); }
+
+	void Build()
+	{
+		int n = mesh->nSegments();
+		std::vector<Bounds2d> bounds(n);
+		cdf.assign(n + 1, 0);
+		for (int i = 0; i < n; i++)
+		{
+			//padded for isOnBoundary, and for the segments along an axis
+			bounds[i] = Bounds2d(mesh->a(i), mesh->b(i));
+			bounds[i].pMin = bounds[i].pMin - Vector2d(EPSILON, EPSILON);
+			bounds[i].pMax = bounds[i].pMax + Vector2d(EPSILON, EPSILON);
+			cdf[i + 1] = cdf[i] + Distance(mesh->a(i), mesh->b(i));
+		}
+		bvh.Build(bounds);
+	}
+
+	//nonzero winding number around p
+	virtual bool isInside(const Point2d& p)
+	{
+		return winding(p) != 0;
+	}
+	virtual bool isOnBoundary(const Point2d& p)
+	{
+		return bvh.Query(p, [&](int i) {
+			return distance(i, p) <= EPSILON;
+		});
+	}
+	//of the nearest segment around p
+	virtual Vector2d getNormal(const Point2d& p)
+	{
+		int nearest = -1;
+		double nearestDistance = InfinityDouble;
+		bvh.Query(p, [&](int i) {
+			double d = distance(i, p);
+			if (d < nearestDistance)
+			{
+				nearestDistance = d;
+				nearest = i;
+			}
+			return false;
+		});
+		if (nearest < 0) return{ 0.f, 1.f };
+		return normal(nearest);
+	}
+	//of the segment IntersectT found
+	virtual Vector2d HitNormal(const Point2d& p, const Hit& hit)
+	{
+		return hit.part < 0 ? getNormal(p) : normal(hit.part);
+	}
+	virtual Bounds2d WorldBound()
+	{
+		return bvh.WorldBound();
+	}
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		for (int i = 0; i < mesh->nSegments(); i++)
+			boundaries->push_back(Boundary::Segment(mesh->a(i), mesh->b(i)));
+	}
+	virtual bool SampleBoundary(double u, Point2d* p, Vector2d* n, double* length)
+	{
+		*length = cdf.back();
+		if (*length <= 0) return false;
+		//the segment whose share of the length holds u
+		int i = (int)(std::upper_bound(cdf.begin(), cdf.end(), u * *length) - cdf.begin()) - 1;
+		i = std::min(std::max(i, 0), mesh->nSegments() - 1);
+		double s = cdf[i + 1] > cdf[i] ? (u * *length - cdf[i]) / (cdf[i + 1] - cdf[i]) : 0;
+		*p = mesh->a(i) + (mesh->b(i) - mesh->a(i)) * std::min(s, 1.0);
+		*n = normal(i);
+		return true;
+	}
+	virtual bool IntersectP(const Ray& ray)
+	{
+		if (isInside(ray.o)) return true;
+		return bvh.IntersectP(ray, [&](int i) {
+			double t;
+			return segment(i, ray, &t) && t >= 0 && t < ray.tMax;
+		});
+	}
+	//the nearest crossing of a segment in [0, tMax)
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		Ray r = ray;	//shrinks as hits are found, to cull the BVH
+		int best = -1;
+		bvh.Intersect(r, [&](int i) {
+			double t;
+			if (!segment(i, r, &t) || t < 0 || t >= r.tMax) return false;
+			r.tMax = t;
+			best = i;
+			return true;
+		});
+		if (best < 0) return false;
+		*hit = Hit{ r.tMax, this, best, 1, 0 };
+		return true;
+	}
+	virtual bool Intersect(const Ray& ray, Interaction* rec)
+	{
+		Hit hit;
+		if (!IntersectT(ray, &hit)) return false;
+		FillHit(ray, hit, rec);
+		return true;
+	}
+	//every crossing of the whole line, those behind the origin for the
+	//winding number there
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		WindingSpans crossings;
+		auto collect = [&](const Ray& r, bool ahead) {
+			bvh.Intersect(r, [&](int i) {
+				double t;
+				if (segment(i, r, &t) && (ahead ? t >= 0 : t > 0))
+				{
+					Vector2d e = mesh->b(i) - mesh->a(i);
+					crossings.Add(ahead ? t : -t, ray.d.x * e.y - ray.d.y * e.x > 0 ? -1 : 1);
+				}
+				return false;
+			});
+		};
+		collect(ray, true);
+		collect(Ray(ray.o, -ray.d), false);
+		return crossings.Spans(this, spans);
+	}
+
+private:
+	const LineMesh* mesh;
+	BVH bvh;
+	std::vector<double> cdf;	//length of the segments before segment i
+
+	Vector2d normal(int i) const
+	{
+		Vector2d e = mesh->b(i) - mesh->a(i);
+		return Normalize(Vector2d(e.y, -e.x));
+	}
+	double distance(int i, const Point2d& p) const
+	{
+		const Point2d& a = mesh->a(i);
+		Vector2d e = mesh->b(i) - a;
+		double l2 = Dot(e, e);
+		double s = l2 > 0 ? std::min(std::max(Dot(p - a, e) / l2, 0.0), 1.0) : 0;
+		return Distance(p, a + e * s);
+	}
+	//where the line of ray crosses segment i, false if it does not. An end
+	//on the line counts as left of it, so a line through a vertex crosses
+	//one of the segments there if it passes, both or neither if it touches.
+	bool segment(int i, const Ray& ray, double* t) const
+	{
+		const Point2d& a = mesh->a(i);
+		const Point2d& b = mesh->b(i);
+		double sideA = ray.d.x * (a.y - ray.o.y) - ray.d.y * (a.x - ray.o.x);
+		double sideB = ray.d.x * (b.y - ray.o.y) - ray.d.y * (b.x - ray.o.x);
+		if ((sideA >= 0) == (sideB >= 0)) return false;
+		Vector2d e = b - a, ao = a - ray.o;
+		*t = (ao.x * e.y - ao.y * e.x) / (sideB - sideA);
+		return true;
+	}
+	//crossings of the ray from p along +x, up through a segment counting +1
+	//and down -1; segments own their lower end and not their upper one
+	int winding(const Point2d& p) const
+	{
+		int w = 0;
+		bvh.Intersect(Ray(p, Vector2d(1, 0)), [&](int i) {
+			const Point2d& a = mesh->a(i);
+			const Point2d& b = mesh->b(i);
+			double left = (b.x - a.x) * (p.y - a.y) - (p.x - a.x) * (b.y - a.y);
+			if (a.y <= p.y && b.y > p.y && left > 0) w++;
+			else if (b.y <= p.y && a.y > p.y && left < 0) w--;
+			return false;
+		});
+		return w;
+	}
+};
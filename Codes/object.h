@@ -1,24 +1,122 @@
 #pragma once
 #include"header.h"
 #include"surface.h"
+#include"bvh.h"
+#include"primitives.h"
+#include"shapetree.h"
+#include<typeinfo>
 class Object
 {
 public:
 	Surface* surface;
 	Material* material;
+	ShapeTree lowered;	//surface as lowered by Lower, used for the queries once there
+	//Beer-Lambert coefficient inside, per unit of Interaction::dis, for the
+	//paths that cross it without scattering in it as a Medium
+	double absorption = 0.34;
+	//area of the bounds, infinite if unbounded: of two nested objects, the
+	//inner one has the smaller
+	double extent;
 
-	Object(Surface* shape, Material* mat) :surface(shape), material(mat) {}
+	Object(Surface* shape, Material* mat) :surface(shape), material(mat), extent(boundsExtent()) {}
+
+	//Lowers surface and tags material for the switch dispatch; Scene::Build does it
+	void Lower()
+	{
+		lowered.Build(surface);
+		material->kind = materialKind(material);
+		extent = boundsExtent();
+	}
 
 	//Intersection
 	bool IntersectP(const Ray& ray)
 	{
-		return surface->IntersectP(ray);
+		return lowered.Empty() ? surface->IntersectP(ray) : lowered.IntersectP(ray);
+	}
+	bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		return lowered.Empty() ? surface->IntersectT(ray, hit) : lowered.IntersectT(ray, hit);
 	}
 	bool Intersect(const Ray& ray, Interaction* rec)
 	{
-		bool result = surface->Intersect(ray, rec);
+		Hit hit;
+		if (!IntersectT(ray, &hit)) return false;
+		FillHit(ray, hit, rec);
 		rec->mat = material;
-		return result;
+		rec->object = this;
+		return true;
+	}
+	bool isInside(const Point2d& p)
+	{
+		return lowered.Empty() ? surface->isInside(p) : lowered.isInside(p);
+	}
+	unsigned IntersectPacket(RayPacket& packet, Interaction* recs)
+	{
+		unsigned mask = lowered.Empty() ? surface->IntersectPacket(packet, recs) : lowered.IntersectPacket(packet, recs);
+		for (int i = 0; i < packet.count; i++)
+			if (mask & (1u << i))
+			{
+				recs[i].mat = material;
+				recs[i].object = this;
+			}
+		return mask;
+	}
+
+private:
+	double boundsExtent()
+	{
+		Bounds2d b = surface->WorldBound();
+		if (b.IsEmpty()) return 0;
+		return b.IsFinite() ? b.Area() : InfinityDouble;
+	}
+};
+//The objects a path is inside, from the outermost to the innermost by
+//Object::extent, so the absorption along a segment is the top's without
+//asking the scene. A path fills it where it starts with Scene::Enclosing
+//and keeps it up to date at every scatter with Cross. Nested deeper than
+//MaxDepth, it no longer knows and says so with overflowed.
+struct MediumStack
+{
+	static const int MaxDepth = 8;
+
+	Object* objects[MaxDepth];
+	int n = 0;
+	bool overflowed = false;	//an object did not fit, Top is not to be trusted
+
+	Object* Top() const { return n > 0 ? objects[n - 1] : nullptr; }
+	//below the objects of smaller extent, whatever the order of entering
+	void Enter(Object* o)
+	{
+		for (int i = 0; i < n; i++)
+			if (objects[i] == o) return;
+		if (n == MaxDepth)
+		{
+			overflowed = true;
+			return;
+		}
+		int i = n++;
+		for (; i > 0 && objects[i - 1]->extent < o->extent; i--)
+			objects[i] = objects[i - 1];
+		objects[i] = o;
+	}
+	//o may not be the top, overlapping objects being left in any order
+	void Leave(Object* o)
+	{
+		for (int i = 0; i < n; i++)
+			if (objects[i] == o)
+			{
+				for (n--; i < n; i++)
+					objects[i] = objects[i + 1];
+				return;
+			}
+	}
+	//after a scatter at hit into wi: wi starts inside the object hit if it
+	//starts behind the surface, outside if in front of it, where it was if on it
+	void Cross(const Interaction& hit, const Ray& wi)
+	{
+		double side = Dot(wi.o - hit.p, hit.n);
+		if (side < 0) Enter(hit.object);
+		else if (side > 0) Leave(hit.object);
 	}
 };
 class Scene
@@ -26,31 +124,246 @@ class Scene
 public:
 	std::vector<Object*> scene_list;
 
-	bool Intersect(const Ray& ray, Interaction* rec)
+	//Builds the BVH over scene_list. Call it once the scene is filled in,
+	//and again whenever scene_list changes; until then every object is tested.
+	//Plain Disks and HalfPlanes go to the flattened stores of primitives.h,
+	//the rest to the BVH over bounded objects or the list of unbounded ones.
+	void Build()
 	{
-		bool hitted = false;
-		double closest_t = ray.tMax;
-		Interaction temp_rec;
+		bounded.clear();
+		unbounded.clear();
+		lights.clear();
+		diskObjects.clear();
+		planeObjects.clear();
+		std::vector<Bounds2d> bounds;
+		std::vector<Disk*> ds;
+		std::vector<HalfPlane*> ps;
 		for (auto& i : scene_list)
 		{
-			ray.tMax = closest_t;
-			if (i->Intersect(ray, &temp_rec))
+			i->Lower();
+			Bounds2d b = i->surface->WorldBound();
+			if (b.IsFinite() && !b.IsEmpty())
 			{
-				hitted = true;
-				closest_t > temp_rec.t ? closest_t = temp_rec.t : closest_t;
-				*rec = temp_rec;
+				if (i->material->isLight)
+					lights.push_back(i);
+				if (typeid(*i->surface) == typeid(Disk))
+				{
+					diskObjects.push_back(i);
+					ds.push_back((Disk*)i->surface);
+					continue;
+				}
+				bounded.push_back(i);
+				bounds.push_back(b);
 			}
+			else if (typeid(*i->surface) == typeid(HalfPlane))
+			{
+				planeObjects.push_back(i);
+				ps.push_back((HalfPlane*)i->surface);
+			}
+			else
+				unbounded.push_back(i);
 		}
-		return hitted;
+		bvh.Build(bounds);
+		disks.Build(ds);
+		halfPlanes.Build(ps);
+		built = true;
 	}
-	bool isInside(const Ray& ray)
+
+	//In two phases: the traversal only keeps the distance of the closest hit
+	//so far and what it is on, and rec is filled once, for the last of them
+	bool Intersect(const Ray& ray, Interaction* rec)
 	{
-		bool isinside = false;
-		for (auto& i : scene_list)
+		Hit closest;
+		Object* object = nullptr;
+		int plane = -1, disk = -1;	//of the flattened primitives
+		auto hit = [&](Object* i)
+		{
+			Hit h;
+			if (i->IntersectT(ray, &h))
+			{
+				closest = h;
+				ray.tMax = h.t;
+				object = i;
+				return true;
+			}
+			return false;
+		};
+
+		if (!built)
 		{
-			if (i->surface->isInside(ray.o))
-				isinside = true;
+			for (auto& i : scene_list)
+				hit(i);
 		}
-		return isinside;
+		else
+		{
+			for (auto& i : unbounded)
+				hit(i);
+			bvh.Intersect(ray, [&](int i) { return hit(bounded[i]); });
+
+			//flattened primitives
+			halfPlanes.ForContaining(ray.o, [&](int i) { hit(planeObjects[i]); });
+			double t;
+			plane = halfPlanes.Intersect(ray, &t);
+			if (plane >= 0)
+				ray.tMax = t;
+			disk = disks.Intersect(ray, &t);
+			if (disk >= 0)
+				ray.tMax = t;
+		}
+
+		if (disk >= 0)
+		{
+			disks.Fill(ray, disk, ray.tMax, rec);
+			object = diskObjects[disk];
+		}
+		else if (plane >= 0)
+		{
+			halfPlanes.Fill(ray, plane, ray.tMax, rec);
+			object = planeObjects[plane];
+		}
+		else if (object)
+			FillHit(ray, closest, rec);
+		else
+			return false;
+		rec->mat = object->material;
+		rec->object = object;
+		return true;
+	}
+	//Intersect for every ray of packet; bit i of the result tells whether
+	//lane i hit anything, recs[i] then holds the closest hit
+	unsigned IntersectPacket(RayPacket& packet, Interaction* recs)
+	{
+		unsigned hitted = 0;
+		auto hit = [&](Object* i)
+		{
+			unsigned mask = i->IntersectPacket(packet, recs);
+			hitted |= mask;
+			return mask != 0;
+		};
+
+		if (!built)
+		{
+			for (auto& i : scene_list)
+				hit(i);
+			return hitted;
+		}
+		for (auto& i : unbounded)
+			hit(i);
+		for (auto& i : planeObjects)
+			hit(i);
+		bvh.IntersectPacket(packet, [&](int i) { return hit(bounded[i]); });
+		int index[PacketSize];
+		unsigned mask = disks.IntersectPacket(packet, index);
+		for (int i = 0; i < packet.count; i++)
+			if (mask & (1u << i))
+			{
+				disks.Fill(packet.ray(i), index[i], packet.tMax[i], &recs[i]);
+				recs[i].mat = diskObjects[index[i]]->material;
+				recs[i].object = diskObjects[index[i]];
+			}
+		return hitted | mask;
+	}
+	//whether anything is hit before ray.tMax
+	bool IntersectP(const Ray& ray)
+	{
+		auto hit = [&](Object* i) { return i->IntersectP(ray); };
+
+		if (!built)
+			return std::any_of(scene_list.begin(), scene_list.end(), hit);
+		if (std::any_of(unbounded.begin(), unbounded.end(), hit))
+			return true;
+		if (halfPlanes.IntersectP(ray) || disks.IntersectP(ray))
+			return true;
+		return bvh.IntersectP(ray, [&](int i) { return hit(bounded[i]); });
 	}
+
+	//Picks one of the bounded lights uniformly, then a direction d uniformly
+	//inside the angle it subtends from p. pdf is the density of d over the
+	//angle, the choice of the light included. Returns nullptr if there is
+	//no light to pick or the picked one surrounds p.
+	Object* SampleLight(const Point2d& p, double u1, double u2, Vector2d* d, double* pdf)
+	{
+		if (lights.empty()) return nullptr;
+		int n = std::min((int)(u1 * lights.size()), (int)lights.size() - 1);
+		double phi, halfAngle;
+		if (!lights[n]->surface->AngularBound(p, &phi, &halfAngle) || halfAngle <= 0)
+			return nullptr;
+		double theta = phi + (2 * u2 - 1) * halfAngle;
+		*d = Vector2d(cos(theta), sin(theta));
+		*pdf = 1 / (lights.size() * 2 * halfAngle);
+		return lights[n];
+	}
+	//density with which SampleLight(p) gives d and light
+	double LightPdf(const Point2d& p, Object* light, const Vector2d& d)
+	{
+		if (!light || !light->material->isLight || lights.empty()) return 0;
+		double phi, halfAngle;
+		if (!light->surface->AngularBound(p, &phi, &halfAngle) || halfAngle <= 0)
+			return 0;
+		Vector2d axis(cos(phi), sin(phi));
+		if (fabs(atan2(axis.x * d.y - axis.y * d.x, Dot(axis, d))) > halfAngle)
+			return 0;
+		return 1 / (lights.size() * 2 * halfAngle);
+	}
+
+	bool isInside(const Ray& ray)
+	{
+		auto inside = [&](Object* i) { return i->isInside(ray.o); };
+
+		if (!built)
+			return std::any_of(scene_list.begin(), scene_list.end(), inside);
+		if (std::any_of(unbounded.begin(), unbounded.end(), inside))
+			return true;
+		if (halfPlanes.isInside(ray.o) || disks.Query(ray.o, [&](int i) { return inside(diskObjects[i]); }))
+			return true;
+		return bvh.Query(ray.o, [&](int i) { return inside(bounded[i]); });
+	}
+	//the innermost object containing p as MediumStack orders them, nullptr
+	//if none
+	Object* Containing(const Point2d& p)
+	{
+		Object* found = nullptr;
+		forContaining(p, [&](Object* i) {
+			if (!found || i->extent < found->extent)
+				found = i;
+			return false;
+		});
+		return found;
+	}
+	//pushes every object containing p to media
+	void Enclosing(const Point2d& p, MediumStack* media)
+	{
+		forContaining(p, [&](Object* i) {
+			media->Enter(i);
+			return false;
+		});
+	}
+
+private:
+	//calls f(object) for the objects containing p, until it returns true
+	template <typename F>
+	bool forContaining(const Point2d& p, F f)
+	{
+		auto inside = [&](Object* i) { return i->isInside(p) && f(i); };
+
+		if (!built)
+			return std::any_of(scene_list.begin(), scene_list.end(), inside);
+		if (std::any_of(unbounded.begin(), unbounded.end(), inside))
+			return true;
+		bool stop = false;
+		halfPlanes.ForContaining(p, [&](int i) { stop = stop || f(planeObjects[i]); });
+		if (stop || disks.Query(p, [&](int i) { return inside(diskObjects[i]); }))
+			return true;
+		return bvh.Query(p, [&](int i) { return inside(bounded[i]); });
+	}
+
+	bool built = false;
+	BVH bvh;
+	std::vector<Object*> bounded;
+	std::vector<Object*> unbounded;
+	std::vector<Object*> lights;	//emitters with finite bounds, the ones SampleLight can aim at
+	DiskStore disks;
+	std::vector<Object*> diskObjects;	//diskObjects[i] holds disks.disks[i]
+	HalfPlaneStore halfPlanes;
+	std::vector<Object*> planeObjects;
 };
\ No newline at end of file
@@ -0,0 +1,160 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include<algorithm>
+#if defined(__AVX__)
+#include<immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include<emmintrin.h>
+#endif
+
+//Ray packets.
+//The rays of a pixel all leave its centre, so a packet keeps one origin
+//and its directions lane by lane, and the intersection kernels run over
+//Simd::Width lanes at a time.
+
+//The widest vector of doubles the build targets: AVX, SSE2 (always there
+//on x64) or a plain double. Comparisons give masks that only &, Select
+//and Bits understand.
+#if defined(__AVX__)
+struct Simd
+{
+	static const int Width = 4;
+	__m256d v;
+
+	Simd() {}
+	Simd(__m256d v) :v(v) {}
+	Simd(double x) :v(_mm256_set1_pd(x)) {}
+	static Simd Load(const double* p) { return _mm256_load_pd(p); }
+	void Store(double* p) const { _mm256_store_pd(p, v); }
+	int Bits() const { return _mm256_movemask_pd(v); }
+
+	friend Simd operator+(const Simd& a, const Simd& b) { return _mm256_add_pd(a.v, b.v); }
+	friend Simd operator-(const Simd& a, const Simd& b) { return _mm256_sub_pd(a.v, b.v); }
+	friend Simd operator*(const Simd& a, const Simd& b) { return _mm256_mul_pd(a.v, b.v); }
+	friend Simd operator/(const Simd& a, const Simd& b) { return _mm256_div_pd(a.v, b.v); }
+	friend Simd operator&(const Simd& a, const Simd& b) { return _mm256_and_pd(a.v, b.v); }
+	friend Simd Min(const Simd& a, const Simd& b) { return _mm256_min_pd(a.v, b.v); }
+	friend Simd Max(const Simd& a, const Simd& b) { return _mm256_max_pd(a.v, b.v); }
+	friend Simd Sqrt(const Simd& a) { return _mm256_sqrt_pd(a.v); }
+	friend Simd Less(const Simd& a, const Simd& b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+	friend Simd LessEqual(const Simd& a, const Simd& b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ); }
+	//mask ? a : b
+	friend Simd Select(const Simd& mask, const Simd& a, const Simd& b) { return _mm256_blendv_pd(b.v, a.v, mask.v); }
+};
+#elif defined(__SSE2__) || defined(_M_X64)
+struct Simd
+{
+	static const int Width = 2;
+	__m128d v;
+
+	Simd() {}
+	Simd(__m128d v) :v(v) {}
+	Simd(double x) :v(_mm_set1_pd(x)) {}
+	static Simd Load(const double* p) { return _mm_load_pd(p); }
+	void Store(double* p) const { _mm_store_pd(p, v); }
+	int Bits() const { return _mm_movemask_pd(v); }
+
+	friend Simd operator+(const Simd& a, const Simd& b) { return _mm_add_pd(a.v, b.v); }
+	friend Simd operator-(const Simd& a, const Simd& b) { return _mm_sub_pd(a.v, b.v); }
+	friend Simd operator*(const Simd& a, const Simd& b) { return _mm_mul_pd(a.v, b.v); }
+	friend Simd operator/(const Simd& a, const Simd& b) { return _mm_div_pd(a.v, b.v); }
+	friend Simd operator&(const Simd& a, const Simd& b) { return _mm_and_pd(a.v, b.v); }
+	friend Simd Min(const Simd& a, const Simd& b) { return _mm_min_pd(a.v, b.v); }
+	friend Simd Max(const Simd& a, const Simd& b) { return _mm_max_pd(a.v, b.v); }
+	friend Simd Sqrt(const Simd& a) { return _mm_sqrt_pd(a.v); }
+	friend Simd Less(const Simd& a, const Simd& b) { return _mm_cmplt_pd(a.v, b.v); }
+	friend Simd LessEqual(const Simd& a, const Simd& b) { return _mm_cmple_pd(a.v, b.v); }
+	friend Simd Select(const Simd& mask, const Simd& a, const Simd& b)
+	{
+		return _mm_or_pd(_mm_and_pd(mask.v, a.v), _mm_andnot_pd(mask.v, b.v));
+	}
+};
+#else
+struct Simd
+{
+	static const int Width = 1;
+	double v;	//1 or 0 for masks
+
+	Simd() {}
+	Simd(double x) :v(x) {}
+	static Simd Load(const double* p) { return *p; }
+	void Store(double* p) const { *p = v; }
+	int Bits() const { return v != 0; }
+
+	friend Simd operator+(const Simd& a, const Simd& b) { return a.v + b.v; }
+	friend Simd operator-(const Simd& a, const Simd& b) { return a.v - b.v; }
+	friend Simd operator*(const Simd& a, const Simd& b) { return a.v * b.v; }
+	friend Simd operator/(const Simd& a, const Simd& b) { return a.v / b.v; }
+	friend Simd operator&(const Simd& a, const Simd& b) { return a.v != 0 && b.v != 0; }
+	friend Simd Min(const Simd& a, const Simd& b) { return a.v < b.v ? a.v : b.v; }
+	friend Simd Max(const Simd& a, const Simd& b) { return a.v > b.v ? a.v : b.v; }
+	friend Simd Sqrt(const Simd& a) { return sqrt(a.v); }
+	friend Simd Less(const Simd& a, const Simd& b) { return a.v < b.v; }
+	friend Simd LessEqual(const Simd& a, const Simd& b) { return a.v <= b.v; }
+	friend Simd Select(const Simd& mask, const Simd& a, const Simd& b) { return mask.v != 0 ? a : b; }
+};
+#endif
+
+const int PacketSize = 8;
+//widest angle between the lanes of a packet made of a pixel's rays;
+//lanes further apart share too few BVH nodes for the packet to pay
+const double MaxPacketSpread = PI / 2;
+
+struct RayPacket
+{
+	Point2d o;
+	int count;	//lanes in use, the rest have tMax = 0 and never hit
+	alignas(32) double dx[PacketSize];
+	alignas(32) double dy[PacketSize];
+	alignas(32) double invDx[PacketSize];
+	alignas(32) double invDy[PacketSize];
+	alignas(32) double tMax[PacketSize];	//shrinks to the closest hit so far, as Ray::tMax
+
+	RayPacket(const Point2d& o) :o(o), count(0)
+	{
+		for (int i = 0; i < PacketSize; i++)
+		{
+			dx[i] = invDx[i] = 1;
+			dy[i] = invDy[i] = 1;
+			tMax[i] = 0;
+		}
+	}
+
+	//false if the packet is full
+	bool Add(const Vector2d& d, double t = InfinityDouble)
+	{
+		if (count == PacketSize) return false;
+		dx[count] = d.x;
+		dy[count] = d.y;
+		invDx[count] = 1 / d.x;
+		invDy[count] = 1 / d.y;
+		tMax[count] = t;
+		count++;
+		return true;
+	}
+	Ray ray(int i) const
+	{
+		return Ray(o, Vector2d(dx[i], dy[i]));
+	}
+};
+
+//Slab test of every lane against b, clipped to [0, tMax] as
+//Bounds2::IntersectP; bit i of the result is lane i
+inline unsigned IntersectP(const Bounds2d& b, const RayPacket& packet)
+{
+	Simd x0(b.pMin.x - packet.o.x), x1(b.pMax.x - packet.o.x);
+	Simd y0(b.pMin.y - packet.o.y), y1(b.pMax.y - packet.o.y);
+	unsigned mask = 0;
+	for (int i = 0; i < PacketSize; i += Simd::Width)
+	{
+		Simd invDx = Simd::Load(packet.invDx + i), invDy = Simd::Load(packet.invDy + i);
+		Simd tx0 = x0 * invDx, tx1 = x1 * invDx;
+		Simd ty0 = y0 * invDy, ty1 = y1 * invDy;
+		Simd tMin = Max(Min(tx0, tx1), Min(ty0, ty1));
+		Simd tMax = Min(Max(tx0, tx1), Max(ty0, ty1));
+		Simd hit = LessEqual(tMin, tMax) & Less(tMin, Simd::Load(packet.tMax + i)) & Less(Simd(0), tMax);
+		mask |= (unsigned)hit.Bits() << i;
+	}
+	return mask;
+}
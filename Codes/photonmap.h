@@ -0,0 +1,315 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"color.h"
+#include"svimg.h"
+#include"random.h"
+#include"object.h"
+#include"integrator.h"
+#include"lighttrace.h"
+#include<algorithm>
+#include<omp.h>
+
+//Photon mapping for caustics.
+//Particles from the lights leave photons at regular steps along their path
+//once they have gone through a Reflector or Refractor, for as long as
+//nothing but those scatters them. The density of photon power around a
+//pixel is the fluence of that light, which camera paths only find when
+//they happen to get through the same surfaces to a light; with
+//RenderSettings::causticPhotons they leave it to the map.
+
+struct Photon
+{
+	Point2d p;
+	Color power;
+	int axis;	//split axis of the kd-tree node the photon is
+
+	Photon() :power(0, 0, 0), axis(0) {}
+	Photon(const Point2d& p, const Color& power) :p(p), power(power), axis(0) {}
+};
+
+//Balanced kd-tree in one flat array: the node of the range [begin, end) is
+//its middle element, the left subtree is before it and the right one after.
+class PhotonKdTree
+{
+public:
+	std::vector<Photon> photons;
+
+	//takes over the contents of ps
+	void Build(std::vector<Photon>& ps)
+	{
+		photons.swap(ps);
+		ps.clear();
+		build(0, (int)photons.size());
+	}
+
+	//The k photons nearest to p as (squared distance, index), in heap
+	//order with the farthest first.
+	void KNearest(const Point2d& p, int k, std::vector<std::pair<double, int>>* nearest) const
+	{
+		nearest->clear();
+		if (k <= 0) return;
+		Range stack[128];
+		int top = 0;
+		stack[top++] = Range(0, (int)photons.size(), 0);
+		while (top)
+		{
+			Range r = stack[--top];
+			if (r.begin >= r.end) continue;
+			if ((int)nearest->size() == k && r.d2 >= nearest->front().first) continue;
+
+			int mid = (r.begin + r.end) / 2;
+			const Photon& ph = photons[mid];
+			double d2 = DistanceSquared(ph.p, p);
+			if ((int)nearest->size() < k)
+			{
+				nearest->push_back(std::make_pair(d2, mid));
+				std::push_heap(nearest->begin(), nearest->end());
+			}
+			else if (d2 < nearest->front().first)
+			{
+				std::pop_heap(nearest->begin(), nearest->end());
+				nearest->back() = std::make_pair(d2, mid);
+				std::push_heap(nearest->begin(), nearest->end());
+			}
+			pushChildren(stack, &top, r, mid, p[ph.axis] - ph.p[ph.axis]);
+		}
+	}
+
+	//Calls f(photon) for every photon within sqrt(r2) of p
+	template <typename F>
+	void RadiusQuery(const Point2d& p, double r2, F f) const
+	{
+		Range stack[128];
+		int top = 0;
+		stack[top++] = Range(0, (int)photons.size(), 0);
+		while (top)
+		{
+			Range r = stack[--top];
+			if (r.begin >= r.end || r.d2 > r2) continue;
+
+			int mid = (r.begin + r.end) / 2;
+			const Photon& ph = photons[mid];
+			if (DistanceSquared(ph.p, p) <= r2)
+				f(ph);
+			pushChildren(stack, &top, r, mid, p[ph.axis] - ph.p[ph.axis]);
+		}
+	}
+
+	//Batched queries, run in parallel.
+	//Squared distance to the k-th nearest photon of every point, or to the
+	//farthest one if there are fewer.
+	void KNearest(const std::vector<Point2d>& points, int k, std::vector<double>* r2) const
+	{
+		r2->assign(points.size(), 0);
+#pragma omp parallel
+		{
+			std::vector<std::pair<double, int>> nearest;
+#pragma omp for schedule(dynamic, 64)
+			for (int i = 0; i < (int)points.size(); i++)
+			{
+				KNearest(points[i], k, &nearest);
+				(*r2)[i] = nearest.empty() ? 0 : nearest.front().first;
+			}
+		}
+	}
+	//power and count of the photons within sqrt(r2[i]) of every points[i]
+	void Gather(const std::vector<Point2d>& points, const std::vector<double>& r2,
+		std::vector<Color>* power, std::vector<int>* count) const
+	{
+		power->assign(points.size(), Color(0, 0, 0));
+		count->assign(points.size(), 0);
+#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < (int)points.size(); i++)
+		{
+			if (r2[i] <= 0) continue;
+			Color sum(0, 0, 0);
+			int n = 0;
+			RadiusQuery(points[i], r2[i], [&](const Photon& ph) {
+				sum += ph.power;
+				n++;
+			});
+			(*power)[i] = sum;
+			(*count)[i] = n;
+		}
+	}
+
+private:
+	struct Range
+	{
+		int begin, end;
+		double d2;	//squared distance from the query to the range's side of the split
+		Range() :begin(0), end(0), d2(0) {}
+		Range(int b, int e, double d) :begin(b), end(e), d2(d) {}
+	};
+
+	//the near child goes on top so that it is visited first
+	static void pushChildren(Range* stack, int* top, const Range& r, int mid, double diff)
+	{
+		Range left(r.begin, mid, r.d2), right(mid + 1, r.end, r.d2);
+		Range& nearChild = diff < 0 ? left : right;
+		Range& farChild = diff < 0 ? right : left;
+		farChild.d2 = std::max(r.d2, diff * diff);
+		stack[(*top)++] = farChild;
+		stack[(*top)++] = nearChild;
+	}
+
+	void build(int begin, int end)
+	{
+		if (end - begin <= 1) return;
+		Bounds2d b;
+		for (int i = begin; i < end; i++)
+			b = Union(b, photons[i].p);
+		int axis = b.MaximumExtent();
+		int mid = (begin + end) / 2;
+		std::nth_element(&photons[begin], &photons[mid], &photons[end - 1] + 1,
+			[axis](const Photon& a, const Photon& b) {
+			return a.p[axis] < b.p[axis];
+		});
+		photons[mid].axis = axis;
+		build(begin, mid);
+		build(mid + 1, end);
+	}
+};
+
+struct PhotonMapSettings
+{
+	int particles = 100000;	//per pass
+	int passes = 4;
+	double step = 4;		//spacing of the photons along a path, in pixels
+	int k = 32;				//photons in the first gather radius
+	double alpha = 0.7;		//fraction of new photons kept when the radius shrinks
+};
+
+//One pass of particles; photons land only inside image
+void tracePhotons(Scene& s, const ParticleEmitter& emitter, const Bounds2d& image, const PhotonMapSettings& pm,
+	int pass, const RenderSettings& settings, std::vector<Photon>* photons, RenderStats* stats)
+{
+	int nThreads = omp_get_max_threads();
+	std::vector<std::vector<Photon>> perThread(nThreads);
+
+	long long paths = 0, segments = 0;
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+:paths,segments)
+	for (int k = 0; k < pm.particles; k++)
+	{
+		std::vector<Photon>& out = perThread[omp_get_thread_num()];
+		RandomStream rng = RandomStream(k, pass, settings.seed).Child(ParticleStreams);
+		paths++;
+		segments += traceParticle(s, emitter, pm.particles, rng, settings, [&](const ParticleSegment& seg) {
+			//direct light is left to the camera paths
+			if (seg.depth == 0) return true;
+			if (!seg.specular) return false;
+			Vector2d d = seg.b - seg.a;
+			double len = d.Length();
+			if (len <= 0) return true;
+			d = d / len;
+			for (double t = pm.step * rng.uniform_0_to_1(); t < len; t += pm.step)
+			{
+				Point2d p = seg.a + d * t;
+				if (image.Inside(p))
+					out.push_back(Photon(p, seg.weight * (pm.step * exp(-seg.sigma * t))));
+			}
+			return true;
+		});
+	}
+	if (stats)
+	{
+		stats->paths += paths;
+		stats->segments += segments;
+	}
+
+	photons->clear();
+	for (auto& t : perThread)
+		photons->insert(photons->end(), t.begin(), t.end());
+}
+
+//Renders img with samples jittered camera paths per pixel for everything
+//but caustics, and progressive photon mapping for those. Every pixel
+//starts with the radius of its pm.k nearest photons; after each pass the
+//radius shrinks so that only pm.alpha of the new photons count.
+void photonMapRender(Image& img, Scene& s, int samples, const PhotonMapSettings& pm,
+	RenderSettings settings, RenderStats* stats)
+{
+	const int w = img.fullResolution.x;
+	const int h = img.fullResolution.y;
+	settings.causticPhotons = true;
+
+	std::vector<Color> camera(w * h, Color(0, 0, 0));
+	long long paths = 0, segments = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:paths,segments)
+	for (int y = 0; y < h; y++)
+	{
+		RenderStats rowStats;
+		for (int x = 0; x < w; x++)
+		{
+			Color c(0, 0, 0);
+			for (int n = 0; n < samples; n++)
+			{
+				Interaction inte;
+				RandomStream rng(y * w + x, n, settings.seed, settings.sampler);
+				c += tracePixel(cameraRay(Point2d(x, y), rng), &inte, s, rng, settings, &rowStats);
+			}
+			c /= samples;
+			camera[y * w + x] = c;
+		}
+		paths += rowStats.paths;
+		segments += rowStats.segments;
+	}
+	if (stats)
+	{
+		stats->paths += paths;
+		stats->segments += segments;
+	}
+
+	Bounds2d image(Point2d(-0.5, -0.5), Point2d(w - 0.5, h - 0.5));
+	ParticleEmitter emitter(s, image);
+	std::vector<Point2d> points(w * h);
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+			points[y * w + x] = Point2d(x, y);
+	std::vector<double> r2(w * h, 0), n(w * h, 0);
+	std::vector<Color> tau(w * h, Color(0, 0, 0));
+
+	PhotonKdTree tree;
+	std::vector<Photon> photons;
+	std::vector<double> kRadius;
+	std::vector<Color> power;
+	std::vector<int> count;
+	for (int pass = 0; pass < pm.passes; pass++)
+	{
+		tracePhotons(s, emitter, image, pm, pass, settings, &photons, stats);
+		tree.Build(photons);
+		if (tree.photons.empty()) continue;
+
+		tree.KNearest(points, pm.k, &kRadius);
+		for (int i = 0; i < w * h; i++)
+			if (r2[i] <= 0) r2[i] = kRadius[i];
+		tree.Gather(points, r2, &power, &count);
+
+		for (int i = 0; i < w * h; i++)
+		{
+			if (n[i] <= 0)
+			{
+				n[i] = count[i];
+				tau[i] += power[i];
+				continue;
+			}
+			double next = n[i] + pm.alpha * count[i];
+			double ratio = next / (n[i] + count[i]);
+			r2[i] *= ratio;
+			tau[i] = (tau[i] + power[i]) * ratio;
+			n[i] = next;
+		}
+	}
+
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++)
+		{
+			int i = y * w + x;
+			Color c = camera[i];
+			if (r2[i] > 0)
+				c += tau[i] * (Inv_2PI / (pm.passes * PI * r2[i]));
+			c = Color(std::min(c.r, 255.0), std::min(c.g, 255.0), std::min(c.b, 255.0));
+			img.setPixel(Point2i(x, y), sqrtColor(c));
+		}
+}
@@ -0,0 +1,292 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"surface.h"
+#include"packet.h"
+#include"bvh.h"
+
+//Flattened primitives.
+//Plain Disks and HalfPlanes are copied out of their Surface objects into
+//blocks of PrimitiveBlockSize, every coordinate in an aligned array of its
+//own, so a ray meets a whole block in one vectorized loop instead of a
+//pointer chase and an indirect call per primitive. The Scene keeps the
+//objects and turns the index of a hit back into one.
+
+const int PrimitiveBlockSize = 8;
+
+struct DiskBlock
+{
+	alignas(32) double cx[PrimitiveBlockSize];
+	alignas(32) double cy[PrimitiveBlockSize];
+	alignas(32) double r2[PrimitiveBlockSize];		//radius squared, -1 in empty slots
+	alignas(32) double index[PrimitiveBlockSize];	//of the disk in the store, -1 in empty slots
+};
+
+//Disks under a BVH whose leaves are blocks
+class DiskStore
+{
+public:
+	std::vector<Disk*> disks;
+
+	DiskStore() :bvh(4 * PrimitiveBlockSize, PrimitiveBlockSize) {}
+
+	void Build(const std::vector<Disk*>& ds)
+	{
+		disks = ds;
+		blocks.clear();
+		std::vector<Bounds2d> bounds;
+		for (auto& d : disks)
+			bounds.push_back(d->WorldBound());
+		bvh.Build(bounds);
+
+		//a leaf's primitives go to the blocks from leafBlock[its offset] on
+		leafBlock.assign(bvh.primitives.size(), -1);
+		for (auto& node : bvh.nodes)
+		{
+			if (node.nPrimitives == 0) continue;
+			leafBlock[node.primitivesOffset] = (int)blocks.size();
+			for (int k = 0; k < node.nPrimitives; k += PrimitiveBlockSize)
+			{
+				DiskBlock b;
+				for (int j = 0; j < PrimitiveBlockSize; j++)
+				{
+					b.cx[j] = b.cy[j] = 0;
+					b.r2[j] = b.index[j] = -1;
+					if (k + j >= node.nPrimitives) continue;
+					int i = bvh.primitives[node.primitivesOffset + k + j];
+					b.cx[j] = disks[i]->c.x;
+					b.cy[j] = disks[i]->c.y;
+					b.r2[j] = disks[i]->r * disks[i]->r;
+					b.index[j] = i;
+				}
+				blocks.push_back(b);
+			}
+		}
+	}
+
+	//Index of the disk ray hits first before ray.tMax, -1 if none; *tHit
+	//is the distance. Same roots as Disk::Intersect.
+	int Intersect(const Ray& ray, double* tHit) const
+	{
+		Ray r = ray;	//shrinks as hits are found, to cull the BVH
+		int best = -1;
+		bvh.IntersectLeaves(r, [&](int offset, int n) {
+			return intersectLeaf(r.o, r.d, offset, n, &r.tMax, &best);
+		});
+		*tHit = r.tMax;
+		return best;
+	}
+	//Intersect for every lane of packet; bit i of the result tells whether
+	//lane i hit a disk, index[i] is then the disk and packet.tMax[i] the distance
+	unsigned IntersectPacket(RayPacket& packet, int* index) const
+	{
+		unsigned hitted = 0;
+		bvh.IntersectPacketLeaves(packet, [&](unsigned lanes, int offset, int n) {
+			for (int i = 0; i < packet.count; i++)
+				if (lanes & (1u << i) &&
+					intersectLeaf(packet.o, Vector2d(packet.dx[i], packet.dy[i]), offset, n, &packet.tMax[i], &index[i]))
+					hitted |= 1u << i;
+		});
+		return hitted;
+	}
+	//fills rec as Disk::Intersect would for a hit of disk i at t
+	void Fill(const Ray& ray, int i, double t, Interaction* rec) const
+	{
+		rec->t = t;
+		rec->p = ray(t);
+		rec->n = Normalize((rec->p - disks[i]->c) / disks[i]->r);
+		rec->wo = Vector2d(-ray.d);
+	}
+
+	//whether any disk contains ray.o or is entered before ray.tMax, as Disk::IntersectP
+	bool IntersectP(const Ray& ray) const
+	{
+		Simd ox(ray.o.x), oy(ray.o.y), dx(ray.d.x), dy(ray.d.y);
+		Simd a(Dot(ray.d, ray.d)), zero(0), tMax(ray.tMax);
+		return bvh.IntersectPLeaves(ray, [&](int offset, int n) {
+			int first = leafBlock[offset];
+			for (int k = 0; k < (n + PrimitiveBlockSize - 1) / PrimitiveBlockSize; k++)
+			{
+				const DiskBlock& b = blocks[first + k];
+				for (int i = 0; i < PrimitiveBlockSize; i += Simd::Width)
+				{
+					Simd ocx = ox - Simd::Load(b.cx + i), ocy = oy - Simd::Load(b.cy + i);
+					Simd hb = dx * ocx + dy * ocy;
+					Simd c = ocx * ocx + ocy * ocy - Simd::Load(b.r2 + i);
+					Simd discriminant = hb * hb - a * c;
+					Simd t0 = (zero - hb - Sqrt(Max(discriminant, zero))) / a;
+					Simd real = LessEqual(zero, Simd::Load(b.index + i));
+					Simd inside = LessEqual(c, zero);
+					Simd entered = LessEqual(zero, discriminant) & LessEqual(zero, t0) & Less(t0, tMax);
+					if ((real & inside).Bits() || (real & entered).Bits())
+						return true;
+				}
+			}
+			return false;
+		});
+	}
+
+	//Calls query(i) for every disk whose box contains p, until it returns true
+	template <typename F>
+	bool Query(const Point2d& p, F query) const
+	{
+		return bvh.Query(p, query);
+	}
+
+private:
+	BVH bvh;
+	std::vector<DiskBlock> blocks;
+	std::vector<int> leafBlock;
+
+	//closest hit before *tMax among the n disks of the leaf from offset;
+	//updates *tMax and *best if there is one
+	bool intersectLeaf(const Point2d& o, const Vector2d& d, int offset, int n, double* tMax, int* best) const
+	{
+		Simd ox(o.x), oy(o.y), dx(d.x), dy(d.y);
+		Simd a(Dot(d, d)), zero(0);
+		bool hit = false;
+		int first = leafBlock[offset];
+		for (int k = 0; k < (n + PrimitiveBlockSize - 1) / PrimitiveBlockSize; k++)
+		{
+			const DiskBlock& b = blocks[first + k];
+			Simd bestT(*tMax), bestIndex(-1);
+			for (int i = 0; i < PrimitiveBlockSize; i += Simd::Width)
+			{
+				Simd ocx = ox - Simd::Load(b.cx + i), ocy = oy - Simd::Load(b.cy + i);
+				Simd hb = dx * ocx + dy * ocy;
+				Simd c = ocx * ocx + ocy * ocy - Simd::Load(b.r2 + i);
+				Simd discriminant = hb * hb - a * c;
+				Simd root = Sqrt(Max(discriminant, zero));
+				Simd t0 = (zero - hb - root) / a, t1 = (zero - hb + root) / a;
+				Simd t = Select(LessEqual(zero, t0), t0, t1);
+				Simd closer = LessEqual(zero, discriminant) & LessEqual(zero, t) & Less(t, bestT) &
+					LessEqual(zero, Simd::Load(b.index + i));
+				bestT = Select(closer, t, bestT);
+				bestIndex = Select(closer, Simd::Load(b.index + i), bestIndex);
+			}
+			alignas(32) double ts[Simd::Width], is[Simd::Width];
+			bestT.Store(ts);
+			bestIndex.Store(is);
+			for (int j = 0; j < Simd::Width; j++)
+				if (is[j] >= 0 && ts[j] < *tMax)
+				{
+					*tMax = ts[j];
+					*best = (int)is[j];
+					hit = true;
+				}
+		}
+		return hit;
+	}
+};
+
+struct HalfPlaneBlock
+{
+	alignas(32) double a[PrimitiveBlockSize];
+	alignas(32) double b[PrimitiveBlockSize];
+	alignas(32) double c[PrimitiveBlockSize];
+	alignas(32) double index[PrimitiveBlockSize];	//-1 in empty slots
+};
+
+//Half-planes, all tested by every ray
+class HalfPlaneStore
+{
+public:
+	std::vector<HalfPlane*> planes;
+
+	void Build(const std::vector<HalfPlane*>& ps)
+	{
+		planes = ps;
+		blocks.clear();
+		for (size_t k = 0; k < planes.size(); k += PrimitiveBlockSize)
+		{
+			HalfPlaneBlock blk;
+			for (int j = 0; j < PrimitiveBlockSize; j++)
+			{
+				blk.a[j] = blk.b[j] = blk.c[j] = 0;
+				blk.index[j] = -1;
+				if (k + j >= planes.size()) continue;
+				blk.a[j] = planes[k + j]->a;
+				blk.b[j] = planes[k + j]->b;
+				blk.c[j] = planes[k + j]->c;
+				blk.index[j] = (double)(k + j);
+			}
+			blocks.push_back(blk);
+		}
+	}
+
+	//HalfPlane::Intersect has its own rules for rays from inside; the
+	//caller takes those planes one at a time through f(i)
+	template <typename F>
+	void ForContaining(const Point2d& p, F f) const
+	{
+		for (size_t i = 0; i < planes.size(); i++)
+			if (planes[i]->HalfPlane::isInside(p))
+				f((int)i);
+	}
+	//Index of the plane hit first before ray.tMax among those not
+	//containing ray.o, -1 if none; *tHit is the distance
+	int Intersect(const Ray& ray, double* tHit) const
+	{
+		Simd ox(ray.o.x), oy(ray.o.y), dx(ray.d.x), dy(ray.d.y), zero(0);
+		Simd bestT(ray.tMax), bestIndex(-1);
+		for (auto& blk : blocks)
+			for (int i = 0; i < PrimitiveBlockSize; i += Simd::Width)
+			{
+				Simd a = Simd::Load(blk.a + i), b = Simd::Load(blk.b + i), c = Simd::Load(blk.c + i);
+				Simd index = Simd::Load(blk.index + i);
+				Simd side = ox * a + oy * b + c;
+				Simd den = dx * a + dy * b;
+				Simd t = (zero - side) / den;
+				Simd closer = LessEqual(zero, index) & Less(side, zero) & Less(zero, den) &
+					Less(zero, t) & Less(t, bestT);
+				bestT = Select(closer, t, bestT);
+				bestIndex = Select(closer, index, bestIndex);
+			}
+		alignas(32) double ts[Simd::Width], is[Simd::Width];
+		bestT.Store(ts);
+		bestIndex.Store(is);
+		int best = -1;
+		*tHit = ray.tMax;
+		for (int j = 0; j < Simd::Width; j++)
+			if (is[j] >= 0 && ts[j] < *tHit)
+			{
+				*tHit = ts[j];
+				best = (int)is[j];
+			}
+		return best;
+	}
+	void Fill(const Ray& ray, int i, double t, Interaction* rec) const
+	{
+		rec->t = t;
+		rec->p = ray(t);
+		rec->n = planes[i]->normal;
+		rec->wo = Vector2d(-ray.d);
+	}
+	//as HalfPlane::IntersectP for every plane
+	bool IntersectP(const Ray& ray) const
+	{
+		Simd ox(ray.o.x), oy(ray.o.y), dx(ray.d.x), dy(ray.d.y), zero(0), tMax(ray.tMax);
+		for (auto& blk : blocks)
+			for (int i = 0; i < PrimitiveBlockSize; i += Simd::Width)
+			{
+				Simd a = Simd::Load(blk.a + i), b = Simd::Load(blk.b + i), c = Simd::Load(blk.c + i);
+				Simd real = LessEqual(zero, Simd::Load(blk.index + i));
+				Simd side = ox * a + oy * b + c;
+				Simd den = dx * a + dy * b;
+				Simd t = (zero - side) / den;
+				if ((real & LessEqual(zero, side)).Bits() || (real & Less(zero, den) & Less(t, tMax)).Bits())
+					return true;
+			}
+		return false;
+	}
+	bool isInside(const Point2d& p) const
+	{
+		for (auto& h : planes)
+			if (h->HalfPlane::isInside(p))
+				return true;
+		return false;
+	}
+
+private:
+	std::vector<HalfPlaneBlock> blocks;
+};
@@ -0,0 +1,162 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"color.h"
+#include"svimg.h"
+#include"random.h"
+#include"object.h"
+#include"integrator.h"
+#include<chrono>
+
+//Progressive rendering.
+//Each pass adds a few jittered samples to every pixel of a floating-point
+//buffer that lives for the whole render, so the image can be written after
+//any pass and the render can stop on time instead of on a sample count
+//fixed up front.
+struct ProgressiveSettings
+{
+	int samplesPerPass = 4;		//numbered on across passes, as the sampler sees one render
+	int targetSamples = 1024;	//per pixel, 0 = no limit
+	double timeBudget = 0;		//seconds of wall-clock, 0 = no limit
+	int snapshotEvery = 1;		//passes between two writes of the image, 0 = only at the end
+};
+
+//Sums of unclamped radiance per pixel and the number of samples in them
+class AccumulationBuffer
+{
+public:
+	Point2i resolution;
+	int samples;
+
+	AccumulationBuffer(const Point2i& resolution)
+		:resolution(resolution), samples(0), sum(resolution.x * resolution.y, Color(0, 0, 0)) {}
+
+	Color& at(int x, int y) { return sum[y * resolution.x + x]; }
+
+	//Writes the mean into img, plus extra[pixel] if given
+	void Resolve(Image& img, const std::vector<Color>* extra = nullptr) const
+	{
+		if (!samples) return;
+		for (int y = 0; y < resolution.y; y++)
+			for (int x = 0; x < resolution.x; x++)
+			{
+				Color c = sum[y * resolution.x + x] * (1.0 / samples);
+				if (extra)
+					c += (*extra)[y * resolution.x + x];
+				c = Color(std::min(c.r, 255.0), std::min(c.g, 255.0), std::min(c.b, 255.0));
+				img.setPixel(Point2i(x, y), sqrtColor(c));
+			}
+	}
+
+private:
+	std::vector<Color> sum;
+};
+
+//Adds n samples to every pixel of buffer, numbered on from buffer.samples
+void renderPass(AccumulationBuffer& buffer, Scene& s, int n, const RenderSettings& settings, RenderStats* stats)
+{
+	const int w = buffer.resolution.x;
+	const int h = buffer.resolution.y;
+	long long paths = 0, segments = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:paths,segments)
+	for (int y = 0; y < h; y++)
+	{
+		RenderStats rowStats;
+		for (int x = 0; x < w; x++)
+		{
+			Color c(0, 0, 0);
+			auto stream = [&](int k) {
+				return RandomStream(y * w + x, buffer.samples + k, settings.seed, settings.sampler);
+			};
+			tracePixelRays(Point2d(x, y), n, s, stream, settings, &rowStats, [&](int k, const Color& L) {
+				c += L;
+			});
+			buffer.at(x, y) += c;
+		}
+		paths += rowStats.paths;
+		segments += rowStats.segments;
+	}
+	if (stats)
+	{
+		stats->paths += paths;
+		stats->segments += segments;
+	}
+	buffer.samples += n;
+}
+
+//Renders img in passes until ps.targetSamples or ps.timeBudget is reached,
+//writing it every ps.snapshotEvery passes. A pass is only started if the
+//passes so far say it will end within the budget, except for the first.
+//Returns the samples per pixel taken.
+int progressiveRender(Image& img, Scene& s, const ProgressiveSettings& ps,
+	const RenderSettings& settings, RenderStats* stats)
+{
+	typedef std::chrono::steady_clock Clock;
+	const int w = img.fullResolution.x;
+	const int h = img.fullResolution.y;
+	const int perPass = std::max(ps.samplesPerPass, 1);
+	Clock::time_point start = Clock::now();
+
+	//the exact direct light does not change from pass to pass
+	std::vector<Color> direct;
+	if (settings.direct)
+	{
+		direct.assign(w * h, Color(0, 0, 0));
+#pragma omp parallel for schedule(dynamic)
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++)
+				direct[y * w + x] = settings.direct->Li(Point2d(x, y));
+	}
+
+	AccumulationBuffer buffer(img.fullResolution);
+	int passes = 0;
+	while (true)
+	{
+		int n = perPass;
+		if (ps.targetSamples > 0)
+			n = std::min(n, ps.targetSamples - buffer.samples);
+		if (n <= 0) break;
+
+		double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		if (ps.timeBudget > 0 && passes && elapsed + elapsed / passes > ps.timeBudget)
+			break;
+
+		renderPass(buffer, s, n, settings, stats);
+		passes++;
+
+		if (ps.snapshotEvery > 0 && passes % ps.snapshotEvery == 0)
+		{
+			buffer.Resolve(img, settings.direct ? &direct : nullptr);
+			img.writeImage();
+			std::cout << "pass " << passes << ": " << buffer.samples << " samples per pixel, "
+				<< std::chrono::duration<double>(Clock::now() - start).count() << "s" << std::endl;
+		}
+	}
+	buffer.Resolve(img, settings.direct ? &direct : nullptr);
+	return buffer.samples;
+}
+
+//Prints the RMS error of the pixel mean (linear, averaged over r, g and b)
+//at 1, 2, 4 ... maxSamples samples per pixel with settings.sampler. Two
+//renders with different seeds differ by sqrt(2) times the error of one.
+void measureConvergence(const Point2i& resolution, Scene& s, int maxSamples, RenderSettings settings, RenderStats* stats)
+{
+	RenderSettings other = settings;
+	other.seed = ~settings.seed;
+	AccumulationBuffer a(resolution), b(resolution);
+	std::cout << (settings.sampler ? settings.sampler->Name() : "independent") << std::endl;
+	for (int n = 1; n <= maxSamples; n *= 2)
+	{
+		renderPass(a, s, n - a.samples, settings, stats);
+		renderPass(b, s, n - b.samples, other, stats);
+		double sum = 0;
+		for (int y = 0; y < resolution.y; y++)
+			for (int x = 0; x < resolution.x; x++)
+			{
+				Color d = (a.at(x, y) - b.at(x, y)) * (1.0 / n);
+				double e = (d.r + d.g + d.b) / 3;
+				sum += e * e;
+			}
+		std::cout << n << " samples per pixel: RMS error " << sqrt(sum / (resolution.x * resolution.y) / 2) << std::endl;
+	}
+}
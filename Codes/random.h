@@ -1,28 +1,107 @@
 #pragma once
-#include<random>
-#include<time.h>
+#include<stdint.h>
 
-std::uniform_real_distribution<double> uniform_Minus1_to_1(-1, 1);
-std::uniform_real_distribution<double> uniform_0_to_1(0, 1);
+//Counter-based random numbers.
+//Every number is a hash of the stream's key (pixel, sample and seed), the
+//bounce and its dimension within the bounce, instead of the next state of
+//a shared engine. Threads have nothing in common to fight over, and a
+//pixel renders the same whichever thread or machine it lands on.
 
-std::mt19937 engine(time(NULL));
+//finalizer of SplitMix64
+inline uint64_t mixBits(uint64_t v)
+{
+	v ^= v >> 30;
+	v *= 0xbf58476d1ce4e5b9ULL;
+	v ^= v >> 27;
+	v *= 0x94d049bb133111ebULL;
+	v ^= v >> 31;
+	return v;
+}
+inline uint64_t hashCombine(uint64_t h, uint64_t v)
+{
+	return mixBits(h ^ mixBits(v + 0x9e3779b97f4a7c15ULL));
+}
+
+//keep the streams of the different kinds of work apart, see RandomStream::Child
+const uint64_t ParticleStreams = 1;
+const uint64_t LineStreams = 2;
+const uint64_t ProbeStreams = 3;
 
-inline double real_rand_uniform_Minus1_to_1()
+//Fixed dimensions within a bounce, so that a decision gets the same one
+//whether or not the others are made. A scatter may use more than one.
+const uint32_t RouletteDimension = 0;
+const uint32_t LightDimension = 1;	//and 2
+const uint32_t ScatterDimension = 3;
+const uint32_t DimensionsPerBounce = 4;
+
+inline uint64_t streamKey(uint64_t pixel, uint64_t sample, uint64_t seed)
 {
-	return uniform_Minus1_to_1(engine);
+	return hashCombine(hashCombine(mixBits(seed), pixel), sample);
 }
-inline double real_rand_uniform_0_to_1()
+//independent uniform number in [0, 1) from 64 random bits
+inline double bitsToUniform(uint64_t bits)
 {
-	return uniform_0_to_1(engine);
+	return (bits >> 11) * (1.0 / 9007199254740992.0);
 }
-Vector2d sample_in_unit_disk()
+
+//Where the numbers of the camera paths come from, see sampler.h
+class Sampler
+{
+public:
+	virtual ~Sampler() {}
+	//coordinate dimension of bounce for sample index of pixel, in [0, 1)
+	virtual double Get(uint64_t pixel, uint64_t index, uint32_t bounce, uint32_t dimension, uint64_t seed) const = 0;
+	virtual const char* Name() const = 0;
+};
+
+class RandomStream
+{
+public:
+	//with a sampler, the numbers are its coordinates of the sample
+	RandomStream(uint64_t pixel, uint64_t sample, uint64_t seed = 0, const Sampler* sampler = nullptr)
+		:key(streamKey(pixel, sample, seed)), pixel(pixel), sample(sample), seed(seed), sampler(sampler),
+		bounce(0), dimension(0) {}
+
+	//the numbers drawn from now on are those of bounce b, from dimension d
+	void Bounce(int b, uint32_t d = 0)
+	{
+		bounce = (uint32_t)b;
+		dimension = d;
+	}
+	//an independent stream, for work that branches off this one
+	RandomStream Child(uint64_t index) const
+	{
+		return RandomStream(hashCombine(key, index));
+	}
+
+	double uniform_0_to_1()
+	{
+		uint32_t d = dimension++;
+		if (sampler)
+			return sampler->Get(pixel, sample, bounce, d, seed);
+		return bitsToUniform(hashCombine(key, ((uint64_t)bounce << 32) | d));
+	}
+	double uniform_Minus1_to_1()
+	{
+		return 2 * uniform_0_to_1() - 1;
+	}
+
+private:
+	uint64_t key;
+	uint64_t pixel, sample, seed;
+	const Sampler* sampler;
+	uint32_t bounce, dimension;
+
+	explicit RandomStream(uint64_t k) :key(k), pixel(0), sample(0), seed(0), sampler(nullptr), bounce(0), dimension(0) {}
+};
+
+Vector2d sample_in_unit_disk(RandomStream& rng)
 {
 	Vector2d p;
 	do
 	{
-		p = 2.0f * Point2d(real_rand_uniform_Minus1_to_1(), real_rand_uniform_Minus1_to_1()) - Point2d(1.0, 1.0);
+		p = 2.0f * Point2d(rng.uniform_Minus1_to_1(), rng.uniform_Minus1_to_1()) - Point2d(1.0, 1.0);
 	} while (p.LengthSquared() >= 1);
 	return p;
 
 }
-
@@ -0,0 +1,170 @@
+#pragma once
+#include"header.h"
+#include"random.h"
+
+//Samplers for the camera paths.
+//A path asks for dimension d of bounce b (see RouletteDimension and the
+//others in random.h). Samplers that spread their points over a few
+//dimensions per bounce give the rest independent numbers, as deeper
+//bounces gain little from better spread.
+
+//Same numbers as a RandomStream without sampler
+class IndependentSampler :public Sampler
+{
+public:
+	virtual double Get(uint64_t pixel, uint64_t index, uint32_t bounce, uint32_t dimension, uint64_t seed) const
+	{
+		return bitsToUniform(hashCombine(streamKey(pixel, index, seed), ((uint64_t)bounce << 32) | dimension));
+	}
+	virtual const char* Name() const { return "independent"; }
+};
+
+//Random permutation of [0, l) indexed by i, from Kensler's "Correlated
+//Multi-Jittered Sampling"
+inline uint32_t permute(uint32_t i, uint32_t l, uint32_t p)
+{
+	uint32_t w = l - 1;
+	w |= w >> 1;
+	w |= w >> 2;
+	w |= w >> 4;
+	w |= w >> 8;
+	w |= w >> 16;
+	do
+	{
+		i ^= p;
+		i *= 0xe170893d;
+		i ^= p >> 16;
+		i ^= (i & w) >> 4;
+		i ^= p >> 8;
+		i *= 0x0929eb3f;
+		i ^= p >> 23;
+		i ^= (i & w) >> 1;
+		i *= 1 | p >> 27;
+		i *= 0x6935fa69;
+		i ^= (i & w) >> 11;
+		i *= 0x74dcb303;
+		i ^= (i & w) >> 2;
+		i *= 0x9e501cc3;
+		i ^= (i & w) >> 2;
+		i *= 0xc860a3df;
+		i &= w;
+		i ^= i >> 5;
+	} while (i >= l);
+	return (i + p) % l;
+}
+
+//Every run of samples samples puts one number in each 1/samples stratum
+//of every dimension, the strata shuffled per dimension and per run
+class StratifiedSampler :public Sampler
+{
+public:
+	int samples;
+
+	StratifiedSampler(int samples) :samples(std::max(samples, 1)) {}
+
+	virtual double Get(uint64_t pixel, uint64_t index, uint32_t bounce, uint32_t dimension, uint64_t seed) const
+	{
+		uint64_t key = hashCombine(streamKey(pixel, index / samples, seed), ((uint64_t)bounce << 32) | dimension);
+		uint32_t stratum = permute((uint32_t)(index % samples), samples, (uint32_t)key);
+		double jitter = bitsToUniform(hashCombine(key, index));
+		return (stratum + jitter) / samples;
+	}
+	virtual const char* Name() const { return "stratified"; }
+};
+
+//Halton sequence over the first HaltonDimensions dimensions, counted
+//bounce after bounce, each pixel's points shifted by its own random offset
+const int HaltonDimensions = 32;
+class HaltonSampler :public Sampler
+{
+public:
+	virtual double Get(uint64_t pixel, uint64_t index, uint32_t bounce, uint32_t dimension, uint64_t seed) const
+	{
+		static const int primes[HaltonDimensions] = {
+			2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+			59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131 };
+		uint64_t key = hashCombine(streamKey(pixel, 0, seed), ((uint64_t)bounce << 32) | dimension);
+		uint64_t d = (uint64_t)bounce * DimensionsPerBounce + dimension;
+		if (dimension >= DimensionsPerBounce || d >= HaltonDimensions)
+			return bitsToUniform(hashCombine(key, index));
+
+		//radical inverse of index in base primes[d]
+		int base = primes[d];
+		double inverse = 0, scale = 1.0 / base;
+		for (uint64_t i = index; i; i /= base, scale /= base)
+			inverse += (i % base) * scale;
+		double u = inverse + bitsToUniform(key);
+		return u >= 1 ? u - 1 : u;
+	}
+	virtual const char* Name() const { return "Halton"; }
+};
+
+//Four-dimensional Sobol points with nested uniform (Owen) scrambling,
+//hashed as in Burley's "Practical Hash-based Owen Scrambling". Each bounce
+//takes its DimensionsPerBounce coordinates from the same points in a
+//shuffled order, so bounces are independent of each other while each is
+//well spread on its own.
+class SobolSampler :public Sampler
+{
+public:
+	SobolSampler()
+	{
+		//direction numbers of Joe and Kuo; the first dimension is van der Corput
+		const int s[3] = { 1, 2, 3 }, a[3] = { 0, 1, 1 };
+		const uint32_t m[3][3] = { { 1 }, { 1, 3 }, { 1, 3, 1 } };
+		for (int j = 0; j < 32; j++)
+			directions[0][j] = 1u << (31 - j);
+		for (int d = 1; d < 4; d++)
+		{
+			uint32_t* v = directions[d];
+			int sd = s[d - 1];
+			for (int j = 0; j < sd; j++)
+				v[j] = m[d - 1][j] << (31 - j);
+			for (int j = sd; j < 32; j++)
+			{
+				v[j] = v[j - sd] ^ (v[j - sd] >> sd);
+				for (int k = 1; k < sd; k++)
+					v[j] ^= ((a[d - 1] >> (sd - 1 - k)) & 1) * v[j - k];
+			}
+		}
+	}
+
+	virtual double Get(uint64_t pixel, uint64_t index, uint32_t bounce, uint32_t dimension, uint64_t seed) const
+	{
+		uint64_t key = hashCombine(streamKey(pixel, 0, seed), bounce);
+		if (dimension >= DimensionsPerBounce)
+			return bitsToUniform(hashCombine(hashCombine(key, dimension), index));
+
+		uint32_t i = owenScramble((uint32_t)index, (uint32_t)key);
+		uint32_t x = 0;
+		for (int j = 0; i; i >>= 1, j++)
+			if (i & 1)
+				x ^= directions[dimension][j];
+		x = owenScramble(x, (uint32_t)hashCombine(key, dimension + 1));
+		return x * (1.0 / 4294967296.0);
+	}
+	virtual const char* Name() const { return "Owen-scrambled Sobol"; }
+
+private:
+	uint32_t directions[4][32];
+
+	static uint32_t reverseBits(uint32_t x)
+	{
+		x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+		x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+		x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+		x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+		return (x >> 16) | (x << 16);
+	}
+	//a bit only ever changes the bits below it, in a way drawn per prefix
+	static uint32_t owenScramble(uint32_t x, uint32_t seed)
+	{
+		x = reverseBits(x);
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return reverseBits(x);
+	}
+};
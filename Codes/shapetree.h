@@ -0,0 +1,392 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"surface.h"
+#include"packet.h"
+#include<typeinfo>
+
+//Lowered surfaces.
+//The Surface classes are how a scene is written down. For rendering, a
+//tree of them is lowered into one array of tagged nodes: the plain shapes
+//are copied into arrays of their own type and the CSG nodes refer to their
+//children by index. A query is then a switch on the tag and direct calls,
+//instead of a virtual call per node and per child. Surfaces of other types
+//are kept as they are and called through Surface. An intersection of
+//HalfPlanes that closes around a region becomes one Box or ConvexPolygon.
+//A tree can also be built node by node, as the arena of a whole scene's
+//shapes: they all sit in a few arrays, children are 32-bit indices, and
+//Clear releases everything at once. ArenaShape shows one of its nodes to
+//Objects as a Surface.
+
+enum class ShapeKind : unsigned char { HalfPlane, Disk, Box, Polygon, Union, Intersect, Substract, Other };
+
+struct ShapeNode
+{
+	ShapeKind kind;
+	int index;			//HalfPlane, Disk, Box, Polygon, Other: into the array of that kind
+	int left, right;	//Union, Intersect, Substract: the children, in nodes
+};
+
+class ShapeTree
+{
+public:
+	bool Empty() const { return nodes.empty(); }
+
+	//Lowers s, which stays the caller's. Build again whenever s changes.
+	void Build(Surface* s)
+	{
+		Clear();
+		lower(s);
+	}
+
+	//Arena: each call appends a node and returns its index
+	void Clear()
+	{
+		nodes.clear();
+		halfPlanes.clear();
+		disks.clear();
+		boxes.clear();
+		polygons.clear();
+		others.clear();
+	}
+	void Reserve(int nNodes) { nodes.reserve(nNodes); }
+	int AddHalfPlane(double a, double b, double c)
+	{
+		halfPlanes.push_back(HalfPlane(a, b, c));
+		return leaf(ShapeKind::HalfPlane, (int)halfPlanes.size() - 1);
+	}
+	int AddDisk(const Point2d& c, double r)
+	{
+		disks.push_back(Disk(c, r));
+		return leaf(ShapeKind::Disk, (int)disks.size() - 1);
+	}
+	int AddBox(const Point2d& p1, const Point2d& p2)
+	{
+		boxes.push_back(Box(p1, p2));
+		return leaf(ShapeKind::Box, (int)boxes.size() - 1);
+	}
+	int AddPolygon(const std::vector<Point2d>& vertices)
+	{
+		polygons.push_back(ConvexPolygon(vertices));
+		return leaf(ShapeKind::Polygon, (int)polygons.size() - 1);
+	}
+	int AddUnion(int left, int right) { return csg(ShapeKind::Union, left, right); }
+	int AddIntersect(int left, int right) { return csg(ShapeKind::Intersect, left, right); }
+	int AddSubstract(int left, int right) { return csg(ShapeKind::Substract, left, right); }
+	//s lowered as by Build, s staying the caller's
+	int Add(Surface* s) { return lower(s); }
+
+	//Same answers as the Surface the tree was built from
+	bool IntersectP(const Ray& ray) { return intersectP(root(), ray); }
+	bool Intersect(const Ray& ray, Interaction* rec) { return intersect(root(), ray, rec); }
+	bool IntersectT(const Ray& ray, Hit* hit) { return intersectT(root(), ray, hit); }
+	bool isInside(const Point2d& p) { return inside(root(), p); }
+	bool isOnBoundary(const Point2d& p) { return onBoundary(root(), p); }
+	Vector2d getNormal(const Point2d& p) { return normal(root(), p); }
+	unsigned IntersectPacket(RayPacket& packet, Interaction* recs) { return IntersectPacket(root(), packet, recs); }
+
+	//Same at any node, for ArenaShape
+	bool IntersectP(int i, const Ray& ray) { return intersectP(i, ray); }
+	bool Intersect(int i, const Ray& ray, Interaction* rec) { return intersect(i, ray, rec); }
+	bool IntersectT(int i, const Ray& ray, Hit* hit) { return intersectT(i, ray, hit); }
+	bool isInside(int i, const Point2d& p) { return inside(i, p); }
+	bool isOnBoundary(int i, const Point2d& p) { return onBoundary(i, p); }
+	Vector2d getNormal(int i, const Point2d& p) { return normal(i, p); }
+	int Spans(int i, const Ray& ray, Span* s) { return spans(i, ray, s); }
+	Bounds2d WorldBound(int i)
+	{
+		const ShapeNode& node = nodes[i];
+		switch (node.kind)
+		{
+		case ShapeKind::HalfPlane: return halfPlanes[node.index].HalfPlane::WorldBound();
+		case ShapeKind::Disk: return disks[node.index].Disk::WorldBound();
+		case ShapeKind::Box: return boxes[node.index].Box::WorldBound();
+		case ShapeKind::Polygon: return polygons[node.index].ConvexPolygon::WorldBound();
+		case ShapeKind::Union: return Union(WorldBound(node.left), WorldBound(node.right));
+		case ShapeKind::Intersect: return ::Intersect(WorldBound(node.left), WorldBound(node.right));
+		case ShapeKind::Substract: return WorldBound(node.left);
+		default: return others[node.index]->WorldBound();
+		}
+	}
+	void getBoundaries(int i, std::vector<Boundary>* boundaries)
+	{
+		const ShapeNode& node = nodes[i];
+		switch (node.kind)
+		{
+		case ShapeKind::HalfPlane: halfPlanes[node.index].HalfPlane::getBoundaries(boundaries); break;
+		case ShapeKind::Disk: disks[node.index].Disk::getBoundaries(boundaries); break;
+		case ShapeKind::Box: boxes[node.index].Box::getBoundaries(boundaries); break;
+		case ShapeKind::Polygon: polygons[node.index].ConvexPolygon::getBoundaries(boundaries); break;
+		case ShapeKind::Other: others[node.index]->getBoundaries(boundaries); break;
+		default:
+			getBoundaries(node.left, boundaries);
+			getBoundaries(node.right, boundaries);
+		}
+	}
+
+	//the vectorized kernels of a plain shape, one ray at a time otherwise
+	unsigned IntersectPacket(int i, RayPacket& packet, Interaction* recs)
+	{
+		const ShapeNode& node = nodes[i];
+		switch (node.kind)
+		{
+		case ShapeKind::HalfPlane: return halfPlanes[node.index].HalfPlane::IntersectPacket(packet, recs);
+		case ShapeKind::Disk: return disks[node.index].Disk::IntersectPacket(packet, recs);
+		case ShapeKind::Box: return boxes[node.index].Box::IntersectPacket(packet, recs);
+		case ShapeKind::Other: return others[node.index]->IntersectPacket(packet, recs);
+		default: break;
+		}
+		unsigned mask = 0;
+		for (int lane = 0; lane < packet.count; lane++)
+		{
+			Ray r(packet.o, Vector2d(packet.dx[lane], packet.dy[lane]), packet.tMax[lane]);
+			Hit hit;
+			if (intersectT(i, r, &hit))
+			{
+				packet.tMax[lane] = std::min(packet.tMax[lane], hit.t);
+				FillHit(r, hit, &recs[lane]);
+				mask |= 1u << lane;
+			}
+		}
+		return mask;
+	}
+
+private:
+	std::vector<ShapeNode> nodes;	//children before their parent, the root last
+	std::vector<HalfPlane> halfPlanes;
+	std::vector<Disk> disks;
+	std::vector<Box> boxes;
+	std::vector<ConvexPolygon> polygons;
+	std::vector<Surface*> others;
+
+	int root() const { return (int)nodes.size() - 1; }
+
+	int leaf(ShapeKind kind, int index)
+	{
+		nodes.push_back(ShapeNode{ kind, index, -1, -1 });
+		return (int)nodes.size() - 1;
+	}
+	int csg(ShapeKind kind, int left, int right)
+	{
+		nodes.push_back(ShapeNode{ kind, -1, left, right });
+		return (int)nodes.size() - 1;
+	}
+
+	int lower(Surface* s)
+	{
+		ShapeNode node;
+		node.index = node.left = node.right = -1;
+		if (typeid(*s) == typeid(HalfPlane))
+		{
+			node.kind = ShapeKind::HalfPlane;
+			node.index = (int)halfPlanes.size();
+			halfPlanes.push_back(*(HalfPlane*)s);
+		}
+		else if (typeid(*s) == typeid(Disk))
+		{
+			node.kind = ShapeKind::Disk;
+			node.index = (int)disks.size();
+			disks.push_back(*(Disk*)s);
+		}
+		else if (typeid(*s) == typeid(Box))
+		{
+			node.kind = ShapeKind::Box;
+			node.index = (int)boxes.size();
+			boxes.push_back(*(Box*)s);
+		}
+		else if (typeid(*s) == typeid(ConvexPolygon))
+		{
+			node.kind = ShapeKind::Polygon;
+			node.index = (int)polygons.size();
+			polygons.push_back(*(ConvexPolygon*)s);
+		}
+		else if (lowerPolygon(s, &node)) {}
+		else if (typeid(*s) == typeid(ShapeUnion))
+		{
+			node.kind = ShapeKind::Union;
+			node.left = lower(((ShapeUnion*)s)->m_shape1);
+			node.right = lower(((ShapeUnion*)s)->m_shape2);
+		}
+		else if (typeid(*s) == typeid(ShapeIntersect))
+		{
+			node.kind = ShapeKind::Intersect;
+			node.left = lower(((ShapeIntersect*)s)->m_shape1);
+			node.right = lower(((ShapeIntersect*)s)->m_shape2);
+		}
+		else if (typeid(*s) == typeid(ShapeSubstract))
+		{
+			node.kind = ShapeKind::Substract;
+			node.left = lower(((ShapeSubstract*)s)->m_shape1);
+			node.right = lower(((ShapeSubstract*)s)->m_shape2);
+		}
+		else
+		{
+			node.kind = ShapeKind::Other;
+			node.index = (int)others.size();
+			others.push_back(s);
+		}
+		nodes.push_back(node);
+		return (int)nodes.size() - 1;
+	}
+	//a bounded intersection of HalfPlanes as a Box if its sides are
+	//axis-aligned, as a ConvexPolygon otherwise
+	bool lowerPolygon(Surface* s, ShapeNode* node)
+	{
+		std::vector<HalfPlane*> planes;
+		std::vector<Point2d> vertices;
+		std::vector<int> edges;
+		if (!s->getHalfPlanes(&planes) || planes.size() < 3 || !intersectHalfPlanes(planes, &vertices, &edges))
+			return false;
+		bool axisAligned = vertices.size() == 4;
+		for (int e : edges)
+			axisAligned = axisAligned && (planes[e]->a == 0 || planes[e]->b == 0);
+		if (axisAligned)
+		{
+			Bounds2d bounds;
+			for (auto& v : vertices)
+				bounds = Union(bounds, v);
+			node->kind = ShapeKind::Box;
+			node->index = (int)boxes.size();
+			boxes.push_back(Box(bounds.pMin, bounds.pMax));
+		}
+		else
+		{
+			node->kind = ShapeKind::Polygon;
+			node->index = (int)polygons.size();
+			polygons.push_back(ConvexPolygon(vertices));
+		}
+		return true;
+	}
+
+	//a node seen as a shape, for the CSG functions of surface.h
+	struct Child
+	{
+		ShapeTree* tree;
+		int i;
+
+		int Spans(const Ray& ray, Span* spans) { return tree->spans(i, ray, spans); }
+		bool isInside(const Point2d& p) { return tree->inside(i, p); }
+		bool isOnBoundary(const Point2d& p) { return tree->onBoundary(i, p); }
+		Vector2d getNormal(const Point2d& p) { return tree->normal(i, p); }
+	};
+
+	bool inside(int i, const Point2d& p)
+	{
+		const ShapeNode& node = nodes[i];
+		switch (node.kind)
+		{
+		case ShapeKind::HalfPlane: return halfPlanes[node.index].HalfPlane::isInside(p);
+		case ShapeKind::Disk: return disks[node.index].Disk::isInside(p);
+		case ShapeKind::Box: return boxes[node.index].Box::isInside(p);
+		case ShapeKind::Polygon: return polygons[node.index].ConvexPolygon::isInside(p);
+		case ShapeKind::Union: return inside(node.left, p) || inside(node.right, p);
+		case ShapeKind::Intersect: return inside(node.left, p) && inside(node.right, p);
+		case ShapeKind::Substract: return inside(node.left, p) && !inside(node.right, p);
+		default: return others[node.index]->isInside(p);
+		}
+	}
+	bool onBoundary(int i, const Point2d& p)
+	{
+		const ShapeNode& node = nodes[i];
+		switch (node.kind)
+		{
+		case ShapeKind::HalfPlane: return halfPlanes[node.index].HalfPlane::isOnBoundary(p);
+		case ShapeKind::Disk: return disks[node.index].Disk::isOnBoundary(p);
+		case ShapeKind::Box: return boxes[node.index].Box::isOnBoundary(p);
+		case ShapeKind::Polygon: return polygons[node.index].ConvexPolygon::isOnBoundary(p);
+		case ShapeKind::Other: return others[node.index]->isOnBoundary(p);
+		default: return onBoundary(node.left, p) || onBoundary(node.right, p);
+		}
+	}
+	Vector2d normal(int i, const Point2d& p)
+	{
+		const ShapeNode& node = nodes[i];
+		Child left = { this, node.left }, right = { this, node.right };
+		switch (node.kind)
+		{
+		case ShapeKind::HalfPlane: return halfPlanes[node.index].HalfPlane::getNormal(p);
+		case ShapeKind::Disk: return disks[node.index].Disk::getNormal(p);
+		case ShapeKind::Box: return boxes[node.index].Box::getNormal(p);
+		case ShapeKind::Polygon: return polygons[node.index].ConvexPolygon::getNormal(p);
+		case ShapeKind::Other: return others[node.index]->getNormal(p);
+		default: return csgNormal(left, right, p, node.kind == ShapeKind::Substract);
+		}
+	}
+	int spans(int i, const Ray& ray, Span* spans)
+	{
+		const ShapeNode& node = nodes[i];
+		Child left = { this, node.left }, right = { this, node.right };
+		switch (node.kind)
+		{
+		case ShapeKind::HalfPlane: return halfPlanes[node.index].HalfPlane::Spans(ray, spans);
+		case ShapeKind::Disk: return disks[node.index].Disk::Spans(ray, spans);
+		case ShapeKind::Box: return boxes[node.index].Box::Spans(ray, spans);
+		case ShapeKind::Polygon: return polygons[node.index].ConvexPolygon::Spans(ray, spans);
+		case ShapeKind::Union: return csgSpans(left, right, SpanOp::Union, ray, spans);
+		case ShapeKind::Intersect: return csgSpans(left, right, SpanOp::Intersect, ray, spans);
+		case ShapeKind::Substract: return csgSpans(left, right, SpanOp::Substract, ray, spans);
+		default: return others[node.index]->Spans(ray, spans);
+		}
+	}
+
+	//a plain shape as itself, CSG from the spans of the whole tree
+	bool intersectP(int i, const Ray& ray)
+	{
+		const ShapeNode& node = nodes[i];
+		Span s[MaxSpans];
+		switch (node.kind)
+		{
+		case ShapeKind::HalfPlane: return halfPlanes[node.index].HalfPlane::IntersectP(ray);
+		case ShapeKind::Disk: return disks[node.index].Disk::IntersectP(ray);
+		case ShapeKind::Box: return boxes[node.index].Box::IntersectP(ray);
+		case ShapeKind::Polygon: return polygons[node.index].ConvexPolygon::IntersectP(ray);
+		case ShapeKind::Other: return others[node.index]->IntersectP(ray);
+		default: return spanIntersectP(s, spans(i, ray, s), ray);
+		}
+	}
+	//the distance and the leaf it is on; the hit's s points into the
+	//arrays, for FillHit to ask the leaf for its normal
+	bool intersectT(int i, const Ray& ray, Hit* hit)
+	{
+		const ShapeNode& node = nodes[i];
+		Span s[MaxSpans];
+		switch (node.kind)
+		{
+		case ShapeKind::HalfPlane: return halfPlanes[node.index].HalfPlane::IntersectT(ray, hit);
+		case ShapeKind::Disk: return disks[node.index].Disk::IntersectT(ray, hit);
+		case ShapeKind::Box: return boxes[node.index].Box::IntersectT(ray, hit);
+		case ShapeKind::Polygon: return polygons[node.index].ConvexPolygon::IntersectT(ray, hit);
+		case ShapeKind::Other: return others[node.index]->IntersectT(ray, hit);
+		default: return spanIntersectT(s, spans(i, ray, s), ray, hit);
+		}
+	}
+	bool intersect(int i, const Ray& ray, Interaction* rec)
+	{
+		Hit hit;
+		if (!intersectT(i, ray, &hit)) return false;
+		FillHit(ray, hit, rec);
+		return true;
+	}
+};
+
+//A node of an arena ShapeTree as a Surface; the tree stays the caller's
+class ArenaShape :public Surface
+{
+public:
+	ArenaShape(ShapeTree* tree, int node) :tree(tree), node(node) {}
+
+	virtual bool IntersectP(const Ray& ray) { return tree->IntersectP(node, ray); }
+	virtual bool Intersect(const Ray& ray, Interaction* rec) { return tree->Intersect(node, ray, rec); }
+	virtual bool IntersectT(const Ray& ray, Hit* hit) { return tree->IntersectT(node, ray, hit); }
+	virtual unsigned IntersectPacket(RayPacket& packet, Interaction* recs) { return tree->IntersectPacket(node, packet, recs); }
+	virtual bool isInside(const Point2d& p) { return tree->isInside(node, p); }
+	virtual bool isOnBoundary(const Point2d& p) { return tree->isOnBoundary(node, p); }
+	virtual Vector2d getNormal(const Point2d& p) { return tree->getNormal(node, p); }
+	virtual Bounds2d WorldBound() { return tree->WorldBound(node); }
+	virtual void getBoundaries(std::vector<Boundary>* boundaries) { tree->getBoundaries(node, boundaries); }
+	virtual int Spans(const Ray& ray, Span* spans) { return tree->Spans(node, ray, spans); }
+
+private:
+	ShapeTree* tree;
+	int node;
+};
@@ -0,0 +1,174 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+
+class Surface;
+
+//Ray spans.
+//The part of a ray's line inside a shape is a sorted list of disjoint
+//spans [t0, t1], t0 and t1 being where the line enters and leaves, and
+//-Infinity or Infinity where it never does. CSG combines its children's
+//lists span by span, so each child is asked once per ray whatever the
+//depth of the tree. Combined lists keep only what is ahead of the ray's
+//origin: spans ending behind it are dropped, and the one around it
+//starts at 0 with no shape there.
+
+const int MaxSpans = 16;	//per list; the farthest spans ahead go first beyond it
+
+struct Span
+{
+	double t0, t1;
+	//shapes whose boundary is crossed at t0 and t1, for the normal there;
+	//nullptr at infinity
+	Surface* s0;
+	Surface* s1;
+	//-1 where the normal of s is flipped, on the boundary of a hole
+	signed char sign0, sign1;
+};
+
+enum class SpanOp : unsigned char { Union, Intersect, Substract };
+
+//Writes a op b into spans and returns their number. Spans that touch are
+//merged, and empty ones and those behind the origin dropped, so that only
+//spans ahead take up the MaxSpans slots.
+inline int combineSpans(const Span* a, int na, const Span* b, int nb, SpanOp op, Span* spans)
+{
+	//the ends of a and b are events of a sweep along the line: event 2k
+	//enters span k, event 2k + 1 leaves it
+	int i = 0, j = 0, n = 0;
+	bool inA = false, inB = false, in = false;
+	while (i < 2 * na || j < 2 * nb)
+	{
+		double ta = i < 2 * na ? (i & 1 ? a[i / 2].t1 : a[i / 2].t0) : 0;
+		double tb = j < 2 * nb ? (j & 1 ? b[j / 2].t1 : b[j / 2].t0) : 0;
+		bool fromA = j >= 2 * nb || (i < 2 * na && ta <= tb);
+		double t;
+		Surface* s;
+		signed char sign;
+		if (fromA)
+		{
+			const Span& e = a[i / 2];
+			t = ta;
+			s = i & 1 ? e.s1 : e.s0;
+			sign = i & 1 ? e.sign1 : e.sign0;
+			inA = !(i & 1);
+			i++;
+		}
+		else
+		{
+			const Span& e = b[j / 2];
+			t = tb;
+			s = j & 1 ? e.s1 : e.s0;
+			sign = j & 1 ? e.sign1 : e.sign0;
+			if (op == SpanOp::Substract)	//the boundary of b is one of a hole
+				sign = -sign;
+			inB = !(j & 1);
+			j++;
+		}
+
+		bool now;
+		switch (op)
+		{
+		case SpanOp::Union: now = inA || inB; break;
+		case SpanOp::Intersect: now = inA && inB; break;
+		default: now = inA && !inB; break;
+		}
+		if (now == in) continue;
+		in = now;
+		if (in)
+		{
+			//touching the previous span: carry on with it
+			if (n > 0 && spans[n - 1].t1 >= t)
+			{
+				n--;
+				continue;
+			}
+			if (n == MaxSpans) break;
+			spans[n].t0 = t;
+			spans[n].s0 = s;
+			spans[n].sign0 = sign;
+		}
+		else
+		{
+			spans[n].t1 = t;
+			spans[n].s1 = s;
+			spans[n].sign1 = sign;
+			if (t < 0 || t <= spans[n].t0)
+				continue;
+			if (spans[n].t0 < 0)
+			{
+				spans[n].t0 = 0;
+				spans[n].s0 = nullptr;
+				spans[n].sign0 = 1;
+			}
+			n++;
+		}
+	}
+	return n;
+}
+
+//Spans of a region inside by the nonzero winding rule, from the crossings
+//of its outline with a ray's line: Add each with +1 or -1 as the outline
+//passes it, in any order. Crossings behind the origin only count towards
+//the winding number there; the nearest MaxCrossings ahead are kept, as
+//the nearest MaxSpans spans are.
+class WindingSpans
+{
+public:
+	static const int MaxCrossings = 4 * MaxSpans;
+
+	WindingSpans() :n(0), wOrigin(0) {}
+
+	void Add(double t, int dw)
+	{
+		if (t < 0)
+		{
+			wOrigin += dw;
+			return;
+		}
+		if (n == MaxCrossings)
+		{
+			if (t >= ts[n - 1]) return;
+			n--;
+		}
+		int i = n++;
+		for (; i > 0 && ts[i - 1] > t; i--)
+		{
+			ts[i] = ts[i - 1];
+			dws[i] = dws[i - 1];
+		}
+		ts[i] = t;
+		dws[i] = dw;
+	}
+	//writes the spans, s being the surface at their ends; one still open
+	//after the last crossing kept is dropped
+	int Spans(Surface* s, Span* spans) const
+	{
+		int count = 0, w = wOrigin;
+		if (w != 0)
+			spans[0] = Span{ 0, InfinityDouble, nullptr, nullptr, 1, 1 };
+		for (int i = 0; i < n; i++)
+		{
+			int wNext = w + dws[i];
+			if (w == 0 && wNext != 0)
+			{
+				if (count == MaxSpans) break;
+				spans[count] = Span{ ts[i], InfinityDouble, s, nullptr, 1, 1 };
+			}
+			else if (w != 0 && wNext == 0)
+			{
+				spans[count].t1 = ts[i];
+				spans[count].s1 = s;
+				if (ts[i] > spans[count].t0) count++;
+			}
+			w = wNext;
+		}
+		return count;
+	}
+
+private:
+	double ts[MaxCrossings];
+	int dws[MaxCrossings];
+	int n;
+	int wOrigin;	//winding number at the origin
+};
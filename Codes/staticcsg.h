@@ -0,0 +1,189 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+#include"surface.h"
+
+//CSG as types.
+//StaticUnion<S1, S2> and the others hold their two shapes by value, so
+//the type of a whole tree is known when it is compiled and every call
+//inside it is direct: the compiler inlines the tree into one function per
+//query. The shapes are any Surfaces, HalfPlane and Disk or more of these.
+//A tree is a Surface like any other, for Objects and the Scene. Build one
+//with staticUnion, staticIntersect and staticSubstract:
+//	auto box = staticIntersect(
+//		staticIntersect(HalfPlane(-1, 0, 290), HalfPlane(1, 0, -150)),
+//		staticIntersect(HalfPlane(0, 1, -150), HalfPlane(0, -1, 290)));
+//Same answers as the ShapeUnion, ShapeIntersect and ShapeSubstract tree.
+
+template <typename S1, typename S2>
+class StaticUnion final :public Surface
+{
+public:
+	S1 m_shape1;
+	S2 m_shape2;
+
+	StaticUnion(const S1& shape1, const S2& shape2) :m_shape1(shape1), m_shape2(shape2) {}
+
+	virtual bool isInside(const Point2d& p)
+	{
+		return m_shape1.isInside(p) || m_shape2.isInside(p);
+	}
+	virtual bool isOnBoundary(const Point2d& p)
+	{
+		return m_shape1.isOnBoundary(p) || m_shape2.isOnBoundary(p);
+	}
+	virtual Vector2d getNormal(const Point2d& p)
+	{
+		return csgNormal(m_shape1, m_shape2, p);
+	}
+	virtual Bounds2d WorldBound()
+	{
+		return Union(m_shape1.WorldBound(), m_shape2.WorldBound());
+	}
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		m_shape1.getBoundaries(boundaries);
+		m_shape2.getBoundaries(boundaries);
+	}
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		return csgSpans(m_shape1, m_shape2, SpanOp::Union, ray, spans);
+	}
+	virtual bool IntersectP(const Ray& ray)
+	{
+		Span spans[MaxSpans];
+		return spanIntersectP(spans, Spans(ray, spans), ray);
+	}
+	virtual bool Intersect(const Ray& ray, Interaction* rec)
+	{
+		Span spans[MaxSpans];
+		return spanIntersect(spans, Spans(ray, spans), ray, rec);
+	}
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		Span spans[MaxSpans];
+		return spanIntersectT(spans, Spans(ray, spans), ray, hit);
+	}
+};
+
+template <typename S1, typename S2>
+class StaticIntersect final :public Surface
+{
+public:
+	S1 m_shape1;
+	S2 m_shape2;
+
+	StaticIntersect(const S1& shape1, const S2& shape2) :m_shape1(shape1), m_shape2(shape2) {}
+
+	virtual bool isInside(const Point2d& p)
+	{
+		return m_shape1.isInside(p) && m_shape2.isInside(p);
+	}
+	virtual bool isOnBoundary(const Point2d& p)
+	{
+		return m_shape1.isOnBoundary(p) || m_shape2.isOnBoundary(p);
+	}
+	virtual Vector2d getNormal(const Point2d& p)
+	{
+		return csgNormal(m_shape1, m_shape2, p);
+	}
+	virtual Bounds2d WorldBound()
+	{
+		return ::Intersect(m_shape1.WorldBound(), m_shape2.WorldBound());
+	}
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		m_shape1.getBoundaries(boundaries);
+		m_shape2.getBoundaries(boundaries);
+	}
+	virtual bool getHalfPlanes(std::vector<HalfPlane*>* planes)
+	{
+		return m_shape1.getHalfPlanes(planes) && m_shape2.getHalfPlanes(planes);
+	}
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		return csgSpans(m_shape1, m_shape2, SpanOp::Intersect, ray, spans);
+	}
+	virtual bool IntersectP(const Ray& ray)
+	{
+		Span spans[MaxSpans];
+		return spanIntersectP(spans, Spans(ray, spans), ray);
+	}
+	virtual bool Intersect(const Ray& ray, Interaction* rec)
+	{
+		Span spans[MaxSpans];
+		return spanIntersect(spans, Spans(ray, spans), ray, rec);
+	}
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		Span spans[MaxSpans];
+		return spanIntersectT(spans, Spans(ray, spans), ray, hit);
+	}
+};
+
+template <typename S1, typename S2>
+class StaticSubstract final :public Surface
+{
+public:
+	S1 m_shape1;
+	S2 m_shape2;
+
+	StaticSubstract(const S1& shape1, const S2& shape2) :m_shape1(shape1), m_shape2(shape2) {}
+
+	virtual bool isInside(const Point2d& p)
+	{
+		return m_shape1.isInside(p) && !m_shape2.isInside(p);
+	}
+	virtual bool isOnBoundary(const Point2d& p)
+	{
+		return m_shape1.isOnBoundary(p) || m_shape2.isOnBoundary(p);
+	}
+	virtual Vector2d getNormal(const Point2d& p)
+	{
+		return csgNormal(m_shape1, m_shape2, p, true);
+	}
+	virtual Bounds2d WorldBound()
+	{
+		return m_shape1.WorldBound();
+	}
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		m_shape1.getBoundaries(boundaries);
+		m_shape2.getBoundaries(boundaries);
+	}
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		return csgSpans(m_shape1, m_shape2, SpanOp::Substract, ray, spans);
+	}
+	virtual bool IntersectP(const Ray& ray)
+	{
+		Span spans[MaxSpans];
+		return spanIntersectP(spans, Spans(ray, spans), ray);
+	}
+	virtual bool Intersect(const Ray& ray, Interaction* rec)
+	{
+		Span spans[MaxSpans];
+		return spanIntersect(spans, Spans(ray, spans), ray, rec);
+	}
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		Span spans[MaxSpans];
+		return spanIntersectT(spans, Spans(ray, spans), ray, hit);
+	}
+};
+
+template <typename S1, typename S2>
+StaticUnion<S1, S2> staticUnion(const S1& shape1, const S2& shape2)
+{
+	return StaticUnion<S1, S2>(shape1, shape2);
+}
+template <typename S1, typename S2>
+StaticIntersect<S1, S2> staticIntersect(const S1& shape1, const S2& shape2)
+{
+	return StaticIntersect<S1, S2>(shape1, shape2);
+}
+template <typename S1, typename S2>
+StaticSubstract<S1, S2> staticSubstract(const S1& shape1, const S2& shape2)
+{
+	return StaticSubstract<S1, S2>(shape1, shape2);
+}
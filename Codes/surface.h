@@ -4,11 +4,109 @@
 #include"geometry.h"
 #include"material.h"
 #include"interaction.h"
+#include"packet.h"
+#include"span.h"
 
+//Circle or line on the boundary of a surface
+struct Boundary
+{
+	bool isCircle;
+	bool isSegment;		//of the line, from p0 to p1
+	bool isEllipse;		//c + u cos(theta) + v sin(theta)
+	Point2d c;			//circle or ellipse centre
+	double r;			//circle radius
+	double a, b, lc;	//line a * x + b * y + lc = 0
+	Point2d p0, p1;		//segment ends
+	Vector2d u, v;		//ellipse axes, conjugate rather than perpendicular
+
+	static Boundary Circle(const Point2d& c, double r)
+	{
+		Boundary bd;
+		bd.isCircle = true;
+		bd.isSegment = false;
+		bd.isEllipse = false;
+		bd.c = c;
+		bd.r = r;
+		bd.a = bd.b = bd.lc = 0;
+		return bd;
+	}
+	static Boundary Line(double a, double b, double c)
+	{
+		Boundary bd;
+		bd.isCircle = false;
+		bd.isSegment = false;
+		bd.isEllipse = false;
+		bd.r = 0;
+		bd.a = a;
+		bd.b = b;
+		bd.lc = c;
+		return bd;
+	}
+	//the inside on the left going from p0 to p1
+	static Boundary Segment(const Point2d& p0, const Point2d& p1)
+	{
+		Vector2d e = p1 - p0;
+		Boundary bd = Line(-e.y, e.x, e.y * p0.x - e.x * p0.y);
+		bd.isSegment = true;
+		bd.p0 = p0;
+		bd.p1 = p1;
+		return bd;
+	}
+	//a circle seen through an affine map, u and v being the images of two
+	//perpendicular radii
+	static Boundary Ellipse(const Point2d& c, const Vector2d& u, const Vector2d& v)
+	{
+		Boundary bd = Circle(c, 0);
+		bd.isCircle = false;
+		bd.isEllipse = true;
+		bd.u = u;
+		bd.v = v;
+		return bd;
+	}
+	Point2d EllipsePoint(double theta) const
+	{
+		return c + u * cos(theta) + v * sin(theta);
+	}
+	//p in the frame where the ellipse is the unit circle
+	Vector2d EllipseFrame(const Point2d& p) const
+	{
+		Vector2d d = p - c;
+		double det = u.x * v.y - v.x * u.y;
+		return Vector2d((d.x * v.y - v.x * d.y) / det, (u.x * d.y - d.x * u.y) / det);
+	}
+	//whether p, on the line or circle, is on the boundary
+	bool Covers(const Point2d& p) const
+	{
+		if (!isSegment) return true;
+		Vector2d e = p1 - p0;
+		double l2 = Dot(e, e);
+		double s = l2 > 0 ? Dot(p - p0, e) / l2 : 0;
+		return s >= 0 && s <= 1;
+	}
+};
+
+class ShapeTree;
+class HalfPlane;
+class Surface;
+
+//What the first phase of Intersect keeps of a crossing: its distance and
+//which part of which shape it is on, for the second phase to work out the
+//rest of the Interaction once, at the hit that turns out closest
+struct Hit
+{
+	double t;
+	Surface* s;			//whose HitNormal gives the normal
+	int part;			//side, segment or piece of s; -1 if only the point tells
+	signed char sign;	//-1 where the normal is flipped, on the boundary of a hole
+	double u;			//parameter along a curved part
+};
+inline void FillHit(const Ray& ray, const Hit& hit, Interaction* rec);
 
 class Surface
 {
 public:
+	virtual ~Surface() {}
+
 	//only determine whether the ray hit the surface
 	virtual bool IntersectP(const Ray& r) = 0;
 
@@ -16,6 +114,19 @@ public:
 	//If it is, return information about the intersection to inte.
 	virtual bool Intersect(const Ray& r, Interaction* inte) = 0;
 
+	//The first phase of Intersect: the same crossing, only its distance and
+	//where it is go to hit, and FillHit makes an Interaction of it later.
+	//This one goes through Intersect.
+	virtual bool IntersectT(const Ray& r, Hit* hit)
+	{
+		Interaction rec;
+		if (!Intersect(r, &rec)) return false;
+		*hit = Hit{ rec.t, this, -1, 1, 0 };
+		return true;
+	}
+	//outward normal at the point p of hit, one IntersectT gave
+	virtual Vector2d HitNormal(const Point2d& p, const Hit& hit) { return getNormal(p); }
+
 	//determine whether the point is inside.
 	virtual bool isInside(const Point2d &p) = 0;
 
@@ -23,8 +134,157 @@ public:
 	virtual bool isOnBoundary(const Point2d &p) = 0;
 
 	virtual Vector2d getNormal(const Point2d& p) = 0;
+
+	//axis-aligned bounds of the inside region, infinite where it is unbounded
+	virtual Bounds2d WorldBound() = 0;
+
+	//angle interval [phi - halfAngle, phi + halfAngle] that covers the surface
+	//as seen from p. False if there is none, i.e. p is inside the bounds.
+	virtual bool AngularBound(const Point2d& p, double* phi, double* halfAngle)
+	{
+		Bounds2d b = WorldBound();
+		if (!b.IsFinite() || b.IsEmpty() || b.Inside(p)) return false;
+
+		//angles of the corners around the direction to the centre
+		Vector2d axis = b.Centroid() - p;
+		double lo = 0, hi = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			Vector2d v = Point2d(b[i & 1].x, b[i >> 1].y) - p;
+			double angle = atan2(axis.x * v.y - axis.y * v.x, Dot(axis, v));
+			lo = std::min(lo, angle);
+			hi = std::max(hi, angle);
+		}
+		*phi = atan2(axis.y, axis.x) + (lo + hi) / 2;
+		*halfAngle = (hi - lo) / 2;
+		return true;
+	}
+
+	//appends the circles, lines and segments the boundary is made of.
+	//A surface that gives none is invisible to DirectLighting's events.
+	virtual void getBoundaries(std::vector<Boundary>* boundaries) {}
+
+	//picks the point p uniformly by arc length on the boundary, n being the
+	//outward normal there and length the length of the whole boundary.
+	//False for surfaces that cannot, they emit no particles in lighttrace.h.
+	virtual bool SampleBoundary(double u, Point2d* p, Vector2d* n, double* length) { return false; }
+
+	//Writes the spans of ray's line inside the surface (see span.h) and
+	//returns their number. This one only sees ahead of ray.o: it follows
+	//Intersect from one crossing to the next.
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		int n = 0;
+		bool inside = isInside(ray.o);
+		if (inside)
+		{
+			spans[0].t0 = -InfinityDouble;
+			spans[0].s0 = nullptr;
+			spans[0].sign0 = 1;
+		}
+		double t = 0;
+		Hit hit;
+		while (n < MaxSpans && IntersectT(Ray(ray(t), ray.d), &hit))
+		{
+			t += hit.t;
+			if (inside)
+			{
+				spans[n].t1 = t;
+				spans[n].s1 = this;
+				spans[n++].sign1 = 1;
+			}
+			else
+			{
+				spans[n].t0 = t;
+				spans[n].s0 = this;
+				spans[n].sign0 = 1;
+			}
+			inside = !inside;
+			t += 0.0001;	//past the crossing
+		}
+		if (inside && n < MaxSpans)
+		{
+			spans[n].t1 = InfinityDouble;
+			spans[n].s1 = nullptr;
+			spans[n++].sign1 = 1;
+		}
+		return n;
+	}
+
+	//Appends the HalfPlanes this surface is the intersection of, for
+	//ShapeTree to lower them to one polygon; false if it is something else.
+	virtual bool getHalfPlanes(std::vector<HalfPlane*>* planes) { return false; }
+
+	//Intersect for every ray of packet. A lane hit before its tMax gets
+	//recs[lane] filled and tMax shrunk to the hit; the result has bit i
+	//set for those lanes. This one takes the rays one at a time.
+	virtual unsigned IntersectPacket(RayPacket& packet, Interaction* recs)
+	{
+		unsigned mask = 0;
+		for (int i = 0; i < packet.count; i++)
+		{
+			Ray r(packet.o, Vector2d(packet.dx[i], packet.dy[i]), packet.tMax[i]);
+			Hit hit;
+			if (IntersectT(r, &hit))
+			{
+				packet.tMax[i] = std::min(packet.tMax[i], hit.t);
+				FillHit(r, hit, &recs[i]);
+				mask |= 1u << i;
+			}
+		}
+		return mask;
+	}
 };
 
+//The second phase of Intersect: the Interaction of hit, ray being the one
+//IntersectT was given
+inline void FillHit(const Ray& ray, const Hit& hit, Interaction* rec)
+{
+	rec->t = hit.t;
+	rec->p = ray(hit.t);
+	rec->n = (double)hit.sign * hit.s->HitNormal(rec->p, hit);
+	rec->wo = Vector2d(-ray.d);
+}
+
+//IntersectT, Intersect and IntersectP of a surface from its spans: the
+//first crossing in [0, ray.tMax), and whether a span covers ray.o or starts
+//before tMax. A span starts behind ray.o, or at it with no shape there,
+//when ray.o is inside.
+inline bool spanIntersectT(const Span* spans, int n, const Ray& ray, Hit* hit)
+{
+	for (int i = 0; i < n; i++)
+	{
+		double t = spans[i].t0;
+		Surface* s = spans[i].s0;
+		signed char sign = spans[i].sign0;
+		if (t < 0 || !s)
+		{
+			t = spans[i].t1;
+			s = spans[i].s1;
+			sign = spans[i].sign1;
+		}
+		if (t < 0) continue;
+		if (t >= ray.tMax || !s) return false;
+		*hit = Hit{ t, s, -1, sign, 0 };
+		return true;
+	}
+	return false;
+}
+inline bool spanIntersect(const Span* spans, int n, const Ray& ray, Interaction* rec)
+{
+	Hit hit;
+	if (!spanIntersectT(spans, n, ray, &hit)) return false;
+	FillHit(ray, hit, rec);
+	return true;
+}
+inline bool spanIntersectP(const Span* spans, int n, const Ray& ray)
+{
+	for (int i = 0; i < n; i++)
+		if (spans[i].t1 >= 0)
+			return spans[i].t0 < ray.tMax;
+	return false;
+}
+
 //Define half-plane(or line): a * x + b * y + c > 0
 //Normal is (a/c,b/c)
 class HalfPlane :public Surface
@@ -49,58 +309,120 @@ public:
 	{
 		return normal;
 	}
+	//only an axis-aligned boundary gives a half-infinite box
+	virtual Bounds2d WorldBound()
+	{
+		Bounds2d bounds(Point2d(-InfinityDouble, -InfinityDouble), Point2d(InfinityDouble, InfinityDouble));
+		if (b == 0 && a != 0)
+		{
+			if (a > 0) bounds.pMin.x = -c / a;
+			else bounds.pMax.x = -c / a;
+		}
+		else if (a == 0 && b != 0)
+		{
+			if (b > 0) bounds.pMin.y = -c / b;
+			else bounds.pMax.y = -c / b;
+		}
+		return bounds;
+	}
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		boundaries->push_back(Boundary::Line(a, b, c));
+	}
+	virtual bool getHalfPlanes(std::vector<HalfPlane*>* planes)
+	{
+		planes->push_back(this);
+		return true;
+	}
 	virtual bool IntersectP(const Ray& ray)
 	{
 		if (isInside(ray.o)) return true;
 
 		if (Dot(ray.d, normal) < 0)	//жϹ뷨Ƿ
-			return true;
+			return -(c + Dot((Vector2d)ray.o, Vector2d(a, b))) / Dot(ray.d, Vector2d(a, b)) < ray.tMax;
 		return false;
 	}
-	virtual bool Intersect(const Ray& ray, Interaction* rec)
+	//the origin is the packet's, so it is inside for all the lanes or none
+	virtual unsigned IntersectPacket(RayPacket& packet, Interaction* recs)
 	{
-		if (isInside(ray.o)) 
+		if (isInside(packet.o))
+			return Surface::IntersectPacket(packet, recs);
+
+		Simd num(-(c + packet.o.x * a + packet.o.y * b)), sa(a), sb(b), zero(0);
+		alignas(32) double t[PacketSize];
+		unsigned mask = 0;
+		for (int i = 0; i < PacketSize; i += Simd::Width)
 		{
-			Point2d inter;
-			inter.x = (b * ray.d.y * ray.o.x - b * ray.d.x * ray.o.y - c * ray.d.x) / (a * ray.d.x + b * ray.d.y);
-			if (ray.d.x) inter.y = (inter.x - ray.o.x) * ray.d.y / ray.d.x + ray.o.y;
-			else inter.y = (-c - a * inter.x) / b;
+			//the direction has to be against the normal (-a, -b)
+			Simd den = Simd::Load(packet.dx + i) * sa + Simd::Load(packet.dy + i) * sb;
+			Simd ti = num / den;
+			Simd hit = Less(zero, den) & Less(zero, ti) & Less(ti, Simd::Load(packet.tMax + i));
+			ti.Store(t + i);
+			mask |= (unsigned)hit.Bits() << i;
+		}
 
-			if ((rec->t = (inter - ray.o).x / ray.d.x) < ray.tMax && rec->t > 0)
-			{
-				rec->p = inter;
-				rec->n = normal;
-				rec->wo = Vector2d(-ray.d);
-				if (Dot(ray.d, (inter - ray.o)) < 0)	//ߵķֱཻ
-				{
-					rec->t = 0;
-					rec->p = ray(0);
-					rec->n = normal;
-					rec->wo = Vector2d(-ray.d);
-					return true;
-				};
-			}
+		for (int i = 0; i < packet.count; i++)
+		{
+			if (!(mask & (1u << i))) continue;
+			Vector2d d(packet.dx[i], packet.dy[i]);
+			recs[i].t = t[i];
+			recs[i].p = packet.o + d * t[i];
+			recs[i].n = normal;
+			recs[i].wo = -d;
+			packet.tMax[i] = t[i];
+		}
+		return mask;
+	}
+	//From outside, the boundary if the ray heads for it; from inside, the
+	//boundary if the ray leaves through it
+	virtual bool Intersect(const Ray& ray, Interaction* rec)
+	{
+		Vector2d ab = Vector2d(a, b);
+		double t = -(c + Dot((Vector2d)ray.o, ab)) / Dot(ray.d, ab);
 
+		if (!isInside(ray.o) && Dot(ray.d, normal) >= 0)
+			return false;
+		if (t < ray.tMax && t > 0)
+		{
+			rec->t = t;
+			rec->p = ray(t);
+			rec->n = normal;
+			rec->wo = Vector2d(-ray.d);
 			return true;
 		}
-
-
+		return false;
+	}
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
 		Vector2d ab = Vector2d(a, b);
 		double t = -(c + Dot((Vector2d)ray.o, ab)) / Dot(ray.d, ab);
 
-		if (Dot(ray.d, normal) < 0)
-			if (t < ray.tMax && t > 0)
-			{
-				rec->t = t;
-				rec->p = ray(t);
-				rec->n = normal;
-				rec->wo = Vector2d(-ray.d);
-				return true;
-			}
-			else
-				return false;
-		else
+		if (!isInside(ray.o) && Dot(ray.d, normal) >= 0)
 			return false;
+		if (t < ray.tMax && t > 0)
+		{
+			*hit = Hit{ t, this, -1, 1, 0 };
+			return true;
+		}
+		return false;
+	}
+	//the line crosses the boundary once at most
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		double side = ray.o.x * a + ray.o.y * b + c;
+		double den = ray.d.x * a + ray.d.y * b;
+		if (den == 0)
+		{
+			if (side < 0) return 0;
+			spans[0] = Span{ -InfinityDouble, InfinityDouble, nullptr, nullptr, 1, 1 };
+			return 1;
+		}
+		double t = -side / den;
+		if (den > 0)
+			spans[0] = Span{ t, InfinityDouble, this, nullptr, 1, 1 };
+		else
+			spans[0] = Span{ -InfinityDouble, t, nullptr, this, 1, 1 };
+		return 1;
 	}
 };
 //Define disk
@@ -124,16 +446,44 @@ public:
 	{
 		return Normalize((p - this->c) / r);
 	}
+	virtual Bounds2d WorldBound()
+	{
+		return Bounds2d(c - Vector2d(r, r), c + Vector2d(r, r));
+	}
+	//the cone of tangents from p
+	virtual bool AngularBound(const Point2d& p, double* phi, double* halfAngle)
+	{
+		Vector2d pc = c - p;
+		double dist = pc.Length();
+		if (dist <= r) return false;
+		*phi = atan2(pc.y, pc.x);
+		*halfAngle = asin(r / dist);
+		return true;
+	}
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		boundaries->push_back(Boundary::Circle(c, r));
+	}
+	virtual bool SampleBoundary(double u, Point2d* p, Vector2d* n, double* length)
+	{
+		double theta = 2 * PI * u;
+		*n = Vector2d(cos(theta), sin(theta));
+		*p = c + *n * r;
+		*length = 2 * PI * r;
+		return true;
+	}
 	virtual bool IntersectP(const Ray& ray)
 	{
 		if (isInside(ray.o)) return true;
 
-		//determine the distance of centre and p
-		double proj = Dot(c - ray.o, ray.d) / ray.d.Length();
-		if (proj < 0)return false;
-		double d = sqrt((c - ray.o).Length() * (c - ray.o).Length() - proj * proj);
-
-		return d <= r;
+		//nearest root, as in Intersect
+		Vector2d oc = ray.o - c;
+		double a = Dot(ray.d, ray.d);
+		double b = Dot(ray.d, oc);
+		double discriminant = b * b - a * (Dot(oc, oc) - r * r);
+		if (discriminant < 0) return false;
+		double t = (-b - sqrt(discriminant)) / a;
+		return t >= 0 && t < ray.tMax;
 		//if (isInside(ray.o)) return true;				//ԲȻཻ
 		//double proj = Dot((c - ray.o) , ray.d)/ray.d.Length();					//poϴľ
 		//if (proj < 0) return false;				//
@@ -141,6 +491,41 @@ public:
 		//double dis = (c - foot).Length();				//Բĵľ
 		//return dis <= r;
 	}
+	//the nearest root in [0, tMax) of every lane, as in Intersect; only the
+	//directions differ between lanes
+	virtual unsigned IntersectPacket(RayPacket& packet, Interaction* recs)
+	{
+		Vector2d oc = packet.o - c;
+		Simd ocx(oc.x), ocy(oc.y), cc(Dot(oc, oc) - r * r), zero(0);
+		alignas(32) double t[PacketSize];
+		unsigned mask = 0;
+		for (int i = 0; i < PacketSize; i += Simd::Width)
+		{
+			Simd dx = Simd::Load(packet.dx + i), dy = Simd::Load(packet.dy + i);
+			Simd tMax = Simd::Load(packet.tMax + i);
+			Simd a = dx * dx + dy * dy;
+			Simd b = dx * ocx + dy * ocy;
+			Simd discriminant = b * b - a * cc;
+			Simd root = Sqrt(Max(discriminant, zero));
+			Simd t0 = (zero - b - root) / a, t1 = (zero - b + root) / a;
+			Simd ti = Select(LessEqual(zero, t0) & Less(t0, tMax), t0, t1);
+			Simd hit = LessEqual(zero, discriminant) & LessEqual(zero, ti) & Less(ti, tMax);
+			ti.Store(t + i);
+			mask |= (unsigned)hit.Bits() << i;
+		}
+
+		for (int i = 0; i < packet.count; i++)
+		{
+			if (!(mask & (1u << i))) continue;
+			Vector2d d(packet.dx[i], packet.dy[i]);
+			recs[i].t = t[i];
+			recs[i].p = packet.o + d * t[i];
+			recs[i].n = Normalize((recs[i].p - c) / r);
+			recs[i].wo = -d;
+			packet.tMax[i] = t[i];
+		}
+		return mask;
+	}
 	virtual bool Intersect(const Ray & ray, Interaction * rec)
 	{
 		Vector2d oc = ray.o - c;
@@ -172,10 +557,470 @@ public:
 		}
 		return false;
 	}
+	//the roots of Intersect; the normal only needs the point
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		Vector2d oc = ray.o - c;
+		double a = Dot(ray.d, ray.d);
+		double b = Dot(ray.d, oc);
+		double discriminant = b * b - a * (Dot(oc, oc) - r * r);
+		if (discriminant < 0) return false;
+		double root = sqrt(discriminant);
+		double t = (-b - root) / a;
+		if (t < 0) t = (-b + root) / a;
+		if (t < 0 || t >= ray.tMax) return false;
+		*hit = Hit{ t, this, -1, 1, 0 };
+		return true;
+	}
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		Vector2d oc = ray.o - c;
+		double a = Dot(ray.d, ray.d);
+		double b = Dot(ray.d, oc);
+		double discriminant = b * b - a * (Dot(oc, oc) - r * r);
+		if (discriminant < 0) return 0;
+		double root = sqrt(discriminant);
+		spans[0] = Span{ (-b - root) / a, (-b + root) / a, this, this, 1, 1 };
+		return 1;
+	}
+};
+
+//Picks p uniformly by arc length on the closed polygon through the count
+//corners, as SampleBoundary; normals[i] is the one of the side from corners[i].
+inline bool sampleSides(const Point2d* corners, const Vector2d* normals, int count, double u, Point2d* p, Vector2d* n, double* length)
+{
+	*length = 0;
+	for (int i = 0; i < count; i++)
+		*length += Distance(corners[i], corners[(i + 1) % count]);
+	double s = u * *length;
+	for (int i = 0; i < count; i++)
+	{
+		double side = Distance(corners[i], corners[(i + 1) % count]);
+		if (s <= side || i == count - 1)
+		{
+			*p = corners[i] + (corners[(i + 1) % count] - corners[i]) * (side > 0 ? std::min(s / side, 1.0) : 0);
+			*n = normals[i];
+			return true;
+		}
+		s -= side;
+	}
+	return false;
+}
+
+//Axis-aligned box, what four HalfPlanes around a rectangle lower to
+class Box :public Surface
+{
+public:
+	Point2d pMin, pMax;
+
+	Box(const Point2d& p1, const Point2d& p2) :pMin(Min(p1, p2)), pMax(Max(p1, p2)) {}
+
+	virtual bool isInside(const Point2d& p)
+	{
+		return p.x >= pMin.x && p.x <= pMax.x && p.y >= pMin.y && p.y <= pMax.y;
+	}
+	virtual bool isOnBoundary(const Point2d& p)
+	{
+		if (p.x < pMin.x - EPSILON || p.x > pMax.x + EPSILON || p.y < pMin.y - EPSILON || p.y > pMax.y + EPSILON)
+			return false;
+		return fabs(p.x - pMin.x) <= EPSILON || fabs(p.x - pMax.x) <= EPSILON ||
+			fabs(p.y - pMin.y) <= EPSILON || fabs(p.y - pMax.y) <= EPSILON;
+	}
+	//of the nearest side
+	virtual Vector2d getNormal(const Point2d& p)
+	{
+		double d[4] = { fabs(p.x - pMin.x), fabs(p.x - pMax.x), fabs(p.y - pMin.y), fabs(p.y - pMax.y) };
+		int nearest = 0;
+		for (int i = 1; i < 4; i++)
+			if (d[i] < d[nearest]) nearest = i;
+		return sideNormal(nearest);
+	}
+	//of the side the slabs gave
+	virtual Vector2d HitNormal(const Point2d& p, const Hit& hit)
+	{
+		return hit.part < 0 ? getNormal(p) : sideNormal(hit.part);
+	}
+	virtual Bounds2d WorldBound()
+	{
+		return Bounds2d(pMin, pMax);
+	}
+	//the lines of the four HalfPlanes
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		boundaries->push_back(Boundary::Line(1, 0, -pMin.x));
+		boundaries->push_back(Boundary::Line(-1, 0, pMax.x));
+		boundaries->push_back(Boundary::Line(0, 1, -pMin.y));
+		boundaries->push_back(Boundary::Line(0, -1, pMax.y));
+	}
+	virtual bool SampleBoundary(double u, Point2d* p, Vector2d* n, double* length)
+	{
+		Point2d corners[4] = { pMin, Point2d(pMax.x, pMin.y), pMax, Point2d(pMin.x, pMax.y) };
+		const Vector2d normals[4] = { Vector2d(0, -1), Vector2d(1, 0), Vector2d(0, 1), Vector2d(-1, 0) };
+		return sampleSides(corners, normals, 4, u, p, n, length);
+	}
+	virtual bool IntersectP(const Ray& ray)
+	{
+		double t0, t1;
+		Vector2d n0, n1;
+		return slabs(ray, &t0, &t1, &n0, &n1) && t1 >= 0 && t0 < ray.tMax;
+	}
+	//the slabs of every lane, and the side as slabs() picks it
+	virtual unsigned IntersectPacket(RayPacket& packet, Interaction* recs)
+	{
+		Simd x0(pMin.x - packet.o.x), x1(pMax.x - packet.o.x);
+		Simd y0(pMin.y - packet.o.y), y1(pMax.y - packet.o.y), zero(0);
+		alignas(32) double t[PacketSize];
+		alignas(32) double side[PacketSize];
+		unsigned mask = 0;
+		for (int i = 0; i < PacketSize; i += Simd::Width)
+		{
+			Simd invDx = Simd::Load(packet.invDx + i), invDy = Simd::Load(packet.invDy + i);
+			Simd tx0 = x0 * invDx, tx1 = x1 * invDx;
+			Simd ty0 = y0 * invDy, ty1 = y1 * invDy;
+			//0 * inf, along a slab from one of its planes: that axis leaves
+			//the line unbounded, as in slabs()
+			tx0 = Select(LessEqual(tx0, tx0), tx0, zero - tx1);
+			tx1 = Select(LessEqual(tx1, tx1), tx1, zero - tx0);
+			ty0 = Select(LessEqual(ty0, ty0), ty0, zero - ty1);
+			ty1 = Select(LessEqual(ty1, ty1), ty1, zero - ty0);
+			Simd nearX = Min(tx0, tx1), nearY = Min(ty0, ty1);
+			Simd farX = Max(tx0, tx1), farY = Max(ty0, ty1);
+			Simd t0 = Max(nearX, nearY), t1 = Min(farX, farY);
+			//x wins ties, as it comes first in slabs()
+			Simd flipX = Less(tx1, tx0), flipY = Less(ty1, ty0);
+			Simd enter = Select(LessEqual(nearY, nearX), Select(flipX, 1, 0), Select(flipY, 3, 2));
+			Simd leave = Select(LessEqual(farX, farY), Select(flipX, 0, 1), Select(flipY, 2, 3));
+			Simd ahead = LessEqual(zero, t0);
+			Simd ti = Select(ahead, t0, t1);
+			Simd hit = Less(t0, t1) & LessEqual(zero, ti) & Less(ti, Simd::Load(packet.tMax + i));
+			ti.Store(t + i);
+			Select(ahead, enter, leave).Store(side + i);
+			mask |= (unsigned)hit.Bits() << i;
+		}
+
+		for (int i = 0; i < packet.count; i++)
+		{
+			if (!(mask & (1u << i))) continue;
+			Vector2d d(packet.dx[i], packet.dy[i]);
+			recs[i].t = t[i];
+			recs[i].p = packet.o + d * t[i];
+			recs[i].n = sideNormal((int)side[i]);
+			recs[i].wo = -d;
+			packet.tMax[i] = t[i];
+		}
+		return mask;
+	}
+	//where the ray enters, or leaves if it starts inside
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		double t0, t1;
+		Vector2d n0, n1;
+		if (!slabs(ray, &t0, &t1, &n0, &n1)) return false;
+		if (t0 < 0)
+		{
+			t0 = t1;
+			n0 = n1;
+		}
+		if (t0 < 0 || t0 >= ray.tMax) return false;
+		*hit = Hit{ t0, this, n0.x != 0 ? n0.x > 0 : 2 + (n0.y > 0), 1, 0 };
+		return true;
+	}
+	virtual bool Intersect(const Ray& ray, Interaction* rec)
+	{
+		Hit hit;
+		if (!IntersectT(ray, &hit)) return false;
+		FillHit(ray, hit, rec);
+		return true;
+	}
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		double t0, t1;
+		Vector2d n0, n1;
+		if (!slabs(ray, &t0, &t1, &n0, &n1)) return 0;
+		spans[0] = Span{ t0, t1, this, this, 1, 1 };
+		return 1;
+	}
+
+private:
+	//of side i: -x, +x, -y, +y
+	static Vector2d sideNormal(int i)
+	{
+		return i < 2 ? Vector2d(i == 0 ? -1 : 1, 0) : Vector2d(0, i == 2 ? -1 : 1);
+	}
+	//The line of ray is inside from *t0 to *t1, entering through the side
+	//of normal *n0 and leaving through *n1; false if it misses.
+	bool slabs(const Ray& ray, double* t0, double* t1, Vector2d* n0, Vector2d* n1) const
+	{
+		*t0 = -InfinityDouble;
+		*t1 = InfinityDouble;
+		for (int axis = 0; axis < 2; axis++)
+		{
+			double o = ray.o[axis], d = ray.d[axis];
+			if (d == 0)
+			{
+				if (o < pMin[axis] || o > pMax[axis]) return false;
+				continue;
+			}
+			double tNear = (pMin[axis] - o) / d, tFar = (pMax[axis] - o) / d;
+			double side = -1;	//of the normal where it enters
+			if (tNear > tFar)
+			{
+				std::swap(tNear, tFar);
+				side = 1;
+			}
+			if (tNear > *t0)
+			{
+				*t0 = tNear;
+				*n0 = axis == 0 ? Vector2d(side, 0) : Vector2d(0, side);
+			}
+			if (tFar < *t1)
+			{
+				*t1 = tFar;
+				*n1 = axis == 0 ? Vector2d(-side, 0) : Vector2d(0, -side);
+			}
+		}
+		return *t0 < *t1;
+	}
 };
 
+//Convex polygon, what other bounded intersections of HalfPlanes lower to
+class ConvexPolygon :public Surface
+{
+public:
+	std::vector<Point2d> vertices;	//counter-clockwise
+	std::vector<Vector2d> normals;	//outward, normals[i] of the edge from vertices[i]
+
+	//vertices in either order
+	ConvexPolygon(const std::vector<Point2d>& vs) :vertices(vs)
+	{
+		double area = 0;
+		for (int i = 0; i < size(); i++)
+			area += vertices[i].x * vertices[next(i)].y - vertices[next(i)].x * vertices[i].y;
+		if (area < 0)
+			std::reverse(vertices.begin(), vertices.end());
+		for (int i = 0; i < size(); i++)
+		{
+			Vector2d e = vertices[next(i)] - vertices[i];
+			normals.push_back(Normalize(Vector2d(e.y, -e.x)));
+		}
+	}
+
+	virtual bool isInside(const Point2d& p)
+	{
+		for (int i = 0; i < size(); i++)
+			if (side(i, p) > 0) return false;
+		return true;
+	}
+	virtual bool isOnBoundary(const Point2d& p)
+	{
+		bool close = false;
+		for (int i = 0; i < size(); i++)
+		{
+			double s = side(i, p);
+			if (s > EPSILON) return false;
+			close = close || s >= -EPSILON;
+		}
+		return close;
+	}
+	//of the nearest edge
+	virtual Vector2d getNormal(const Point2d& p)
+	{
+		int nearest = 0;
+		for (int i = 1; i < size(); i++)
+			if (fabs(side(i, p)) < fabs(side(nearest, p))) nearest = i;
+		return normals[nearest];
+	}
+	//of the edge clip gave
+	virtual Vector2d HitNormal(const Point2d& p, const Hit& hit)
+	{
+		return hit.part < 0 ? getNormal(p) : normals[hit.part];
+	}
+	virtual Bounds2d WorldBound()
+	{
+		Bounds2d bounds;
+		for (auto& v : vertices)
+			bounds = Union(bounds, v);
+		return bounds;
+	}
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		for (int i = 0; i < size(); i++)
+			boundaries->push_back(Boundary::Line(-normals[i].x, -normals[i].y, Dot(normals[i], (Vector2d)vertices[i])));
+	}
+	virtual bool SampleBoundary(double u, Point2d* p, Vector2d* n, double* length)
+	{
+		return sampleSides(vertices.data(), normals.data(), size(), u, p, n, length);
+	}
+	virtual bool IntersectP(const Ray& ray)
+	{
+		double t0, t1;
+		int e0, e1;
+		return clip(ray, &t0, &t1, &e0, &e1) && t1 >= 0 && t0 < ray.tMax;
+	}
+	//where the ray enters, or leaves if it starts inside
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		double t0, t1;
+		int e0, e1;
+		if (!clip(ray, &t0, &t1, &e0, &e1)) return false;
+		if (t0 < 0)
+		{
+			t0 = t1;
+			e0 = e1;
+		}
+		if (t0 < 0 || t0 >= ray.tMax) return false;
+		*hit = Hit{ t0, this, e0, 1, 0 };
+		return true;
+	}
+	virtual bool Intersect(const Ray& ray, Interaction* rec)
+	{
+		Hit hit;
+		if (!IntersectT(ray, &hit)) return false;
+		FillHit(ray, hit, rec);
+		return true;
+	}
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		double t0, t1;
+		int e0, e1;
+		if (!clip(ray, &t0, &t1, &e0, &e1)) return 0;
+		spans[0] = Span{ t0, t1, this, this, 1, 1 };
+		return 1;
+	}
+
+private:
+	int size() const { return (int)vertices.size(); }
+	int next(int i) const { return i + 1 == size() ? 0 : i + 1; }
+	//signed distance of p to the line of edge i, positive outside
+	double side(int i, const Point2d& p) const { return Dot(normals[i], p - vertices[i]); }
+
+	//Cyrus-Beck: the line of ray is inside from *t0 to *t1, entering
+	//through edge *e0 and leaving through *e1; false if it misses
+	bool clip(const Ray& ray, double* t0, double* t1, int* e0, int* e1) const
+	{
+		*t0 = -InfinityDouble;
+		*t1 = InfinityDouble;
+		*e0 = *e1 = 0;
+		for (int i = 0; i < size(); i++)
+		{
+			double num = -side(i, ray.o), den = Dot(normals[i], ray.d);
+			if (den == 0)
+			{
+				if (num < 0) return false;
+				continue;
+			}
+			double t = num / den;
+			if (den < 0 && t > *t0)
+			{
+				*t0 = t;
+				*e0 = i;
+			}
+			else if (den > 0 && t < *t1)
+			{
+				*t1 = t;
+				*e1 = i;
+			}
+		}
+		return *t0 < *t1;
+	}
+};
+
+//The corners of the intersection of planes, counter-clockwise, and
+//edges[i] the plane the edge from corner i lies on; false if the
+//intersection is empty or unbounded.
+inline bool intersectHalfPlanes(const std::vector<HalfPlane*>& planes, std::vector<Point2d>* vertices, std::vector<int>* edges)
+{
+	//clip a square far beyond the scene, whose sides are plane -1
+	const double big = 1e9;
+	std::vector<Point2d> vs = { Point2d(-big, -big), Point2d(big, -big), Point2d(big, big), Point2d(-big, big) };
+	std::vector<int> es(4, -1);
+	for (int k = 0; k < (int)planes.size(); k++)
+	{
+		const HalfPlane& h = *planes[k];
+		std::vector<Point2d> clippedVs;
+		std::vector<int> clippedEs;
+		for (size_t i = 0; i < vs.size(); i++)
+		{
+			const Point2d& p = vs[i];
+			const Point2d& q = vs[(i + 1) % vs.size()];
+			double fp = p.x * h.a + p.y * h.b + h.c, fq = q.x * h.a + q.y * h.b + h.c;
+			if (fp >= 0)
+			{
+				clippedVs.push_back(p);
+				clippedEs.push_back(es[i]);
+			}
+			if ((fp >= 0) != (fq >= 0))
+			{
+				//the crossing starts the edge on plane k when leaving, the rest of edge i when entering
+				clippedVs.push_back(p + (q - p) * (fp / (fp - fq)));
+				clippedEs.push_back(fp >= 0 ? k : es[i]);
+			}
+		}
+		vs.swap(clippedVs);
+		es.swap(clippedEs);
+		if (vs.size() < 3) return false;
+	}
+
+	//each corner again from the two lines through it, for a square box to
+	//come out square; edges shorter than that precision are dropped
+	vertices->clear();
+	edges->clear();
+	for (size_t i = 0; i < vs.size(); i++)
+	{
+		int e = es[i], previous = es[(i + vs.size() - 1) % vs.size()];
+		if (e < 0 || previous < 0) return false;
+		const HalfPlane& h1 = *planes[previous];
+		const HalfPlane& h2 = *planes[e];
+		double det = h1.a * h2.b - h2.a * h1.b;
+		Point2d v = vs[i];
+		if (det != 0)
+			v = Point2d((h1.b * h2.c - h2.b * h1.c) / det, (h1.c * h2.a - h2.c * h1.a) / det);
+		if (!vertices->empty() && Distance(vertices->back(), v) <= EPSILON)
+		{
+			edges->back() = e;
+			continue;
+		}
+		vertices->push_back(v);
+		edges->push_back(e);
+	}
+	if (vertices->size() > 1 && Distance(vertices->back(), vertices->front()) <= EPSILON)
+	{
+		vertices->pop_back();
+		edges->pop_back();
+	}
+	return vertices->size() >= 3;
+}
+
+//CSG of two shapes s1 and s2 of any types with the queries of Surface.
+//ShapeUnion and the others below call these with their children, as do
+//ShapeTree and the static shapes of staticcsg.h with theirs.
+template <typename S1, typename S2>
+Vector2d csgNormal(S1& s1, S2& s2, const Point2d& p, bool substract = false)
+{
+	double sign2 = substract ? -1 : 1;
+	if (s1.isOnBoundary(p) && s2.isOnBoundary(p))
+		return (s1.getNormal(p) + sign2 * s2.getNormal(p)) / 2.f;
+	if (s1.isOnBoundary(p))
+		return s1.getNormal(p);
+	if (s2.isOnBoundary(p))
+		return sign2 * s2.getNormal(p);
+	return{ 0.f, 1.f };
+}
+//each child's spans once, combined by op
+template <typename S1, typename S2>
+int csgSpans(S1& s1, S2& s2, SpanOp op, const Ray& ray, Span* spans)
+{
+	Span spans1[MaxSpans], spans2[MaxSpans];
+	int n1 = s1.Spans(ray, spans1);
+	if (n1 == 0 && op != SpanOp::Union)	//nothing to keep any of s2 in
+		return 0;
+	int n2 = s2.Spans(ray, spans2);
+	return combineSpans(spans1, n1, spans2, n2, op, spans);
+}
+
 class ShapeUnion :public Surface
 {
+	friend class ShapeTree;
 private:
 	Surface* m_shape1;
 	Surface* m_shape2;
@@ -200,41 +1045,42 @@ public:
 	}
 	virtual Vector2d getNormal(const Point2d& p)
 	{
-		if (m_shape1->isOnBoundary(p) && m_shape2->isOnBoundary(p))
-			return (m_shape1->getNormal(p) + m_shape2->getNormal(p)) / 2.f;
-		if (m_shape1->isOnBoundary(p))
-			return m_shape1->getNormal(p);
-		if (m_shape2->isOnBoundary(p))
-			return m_shape2->getNormal(p);
-		return{ 0.f, 1.f };
+		return csgNormal(*m_shape1, *m_shape2, p);
+	}
+	virtual Bounds2d WorldBound()
+	{
+		return Union(m_shape1->WorldBound(), m_shape2->WorldBound());
+	}
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		m_shape1->getBoundaries(boundaries);
+		m_shape2->getBoundaries(boundaries);
+	}
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		return csgSpans(*m_shape1, *m_shape2, SpanOp::Union, ray, spans);
 	}
 	virtual bool IntersectP(const Ray & ray)
 	{
-		Interaction rec1, rec2;
-		if (!(m_shape1->Intersect(ray,&rec1) || m_shape2->Intersect(ray, &rec2)))
-			return false;
-		return true;
+		Span spans[MaxSpans];
+		return spanIntersectP(spans, Spans(ray, spans), ray);
 	}
 
 	virtual bool Intersect(const Ray& ray, Interaction * rec)
 	{
-		Interaction rec1, rec2;
-		bool res1 = m_shape1->Intersect(ray, &rec1);
-		bool res2 = m_shape2->Intersect(ray, &rec2);
-		if (!res1 && !res2)
-			return false;
-		if (!res1)
-			*rec = rec2;
-		else if (!res2)
-			*rec = rec1;
-		else
-			*rec = (rec1.p - ray.o).Length() > (rec2.p - ray.o).Length() ? rec2 : rec1;
-		return true;
+		Span spans[MaxSpans];
+		return spanIntersect(spans, Spans(ray, spans), ray, rec);
+	}
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		Span spans[MaxSpans];
+		return spanIntersectT(spans, Spans(ray, spans), ray, hit);
 	}
 };
 
 class ShapeIntersect : public Surface
 {
+	friend class ShapeTree;
 private:
 	Surface* m_shape1;
 	Surface* m_shape2;
@@ -259,43 +1105,48 @@ public:
 	}
 	virtual Vector2d getNormal(const Point2d& p)
 	{
-		if (m_shape1->isOnBoundary(p) && m_shape2->isOnBoundary(p))
-			return ((m_shape1->getNormal(p)) + (m_shape2->getNormal(p))) / 2.f;
-		if (m_shape1->isOnBoundary(p))
-			return m_shape1->getNormal(p);
-		if (m_shape2->isOnBoundary(p))
-			return m_shape2->getNormal(p);
-		return{ 0.f, 1.f };
+		return csgNormal(*m_shape1, *m_shape2, p);
+	}
+	virtual Bounds2d WorldBound()
+	{
+		return ::Intersect(m_shape1->WorldBound(), m_shape2->WorldBound());
+	}
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		m_shape1->getBoundaries(boundaries);
+		m_shape2->getBoundaries(boundaries);
+	}
+	virtual bool getHalfPlanes(std::vector<HalfPlane*>* planes)
+	{
+		return m_shape1->getHalfPlanes(planes) && m_shape2->getHalfPlanes(planes);
+	}
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		return csgSpans(*m_shape1, *m_shape2, SpanOp::Intersect, ray, spans);
 	}
 
 	virtual bool IntersectP(const Ray&ray)
 	{
-		Interaction rec1, rec2;
-		if (!(m_shape1->Intersect(ray, &rec1) && m_shape2->Intersect(ray, &rec2)))
-			return false;
-		return m_shape2->isInside(rec1.p) || m_shape1->isInside(rec2.p);
+		Span spans[MaxSpans];
+		return spanIntersectP(spans, Spans(ray, spans), ray);
 	}
 
 	virtual bool Intersect(const Ray& ray, Interaction* inter)
 	{
-		Interaction rec1, rec2;
-		if (!(m_shape1->Intersect(ray, &rec1) && m_shape2->Intersect(ray, &rec2)))
-			return false;
-		if (m_shape2->isInside(rec1.p) && m_shape1->isInside(rec2.p))	//㶼ϷȡĽ
-			*inter = (rec1.p - ray.o).Length() > (rec2.p - ray.o).Length() ? rec2 : rec1;
-		else if (m_shape2->isInside(rec1.p))
-			*inter = rec1;
-		else if (m_shape1->isInside(rec2.p))
-			*inter = rec2;
-		else
-			return false;
-		return true;
+		Span spans[MaxSpans];
+		return spanIntersect(spans, Spans(ray, spans), ray, inter);
+	}
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		Span spans[MaxSpans];
+		return spanIntersectT(spans, Spans(ray, spans), ray, hit);
 	}
 };
 
-
+//shape1 with shape2 cut out of it
 class ShapeSubstract : public Surface
 {
+	friend class ShapeTree;
 private:
 	Surface* m_shape1;
 	Surface* m_shape2;
@@ -311,7 +1162,7 @@ public:
 	}
 	virtual bool isInside(const Point2d& p)
 	{
-		return m_shape1->isInside(p) && m_shape2->isInside(p);
+		return m_shape1->isInside(p) && !m_shape2->isInside(p);
 	}
 
 	virtual bool isOnBoundary(const Point2d& p)
@@ -320,36 +1171,37 @@ public:
 	}
 	virtual Vector2d getNormal(const Point2d& p)
 	{
-		if (m_shape1->isOnBoundary(p) && m_shape2->isOnBoundary(p))
-			return ((m_shape1->getNormal(p)) + (m_shape2->getNormal(p))) / 2.f;
-		if (m_shape1->isOnBoundary(p))
-			return m_shape1->getNormal(p);
-		if (m_shape2->isOnBoundary(p))
-			return m_shape2->getNormal(p);
-		return{ 0.f, 1.f };
+		return csgNormal(*m_shape1, *m_shape2, p, true);
+	}
+	//what is left of shape1 cannot exceed shape1
+	virtual Bounds2d WorldBound()
+	{
+		return m_shape1->WorldBound();
+	}
+	virtual void getBoundaries(std::vector<Boundary>* boundaries)
+	{
+		m_shape1->getBoundaries(boundaries);
+		m_shape2->getBoundaries(boundaries);
+	}
+	virtual int Spans(const Ray& ray, Span* spans)
+	{
+		return csgSpans(*m_shape1, *m_shape2, SpanOp::Substract, ray, spans);
 	}
 
 	virtual bool IntersectP(const Ray & ray)
 	{
-		Interaction rec1, rec2;
-		if (!(m_shape1->Intersect(ray, &rec1) && m_shape2->Intersect(ray, &rec2)))
-			return false;
-		return m_shape2->isInside(rec1.p) || m_shape1->isInside(rec2.p);
+		Span spans[MaxSpans];
+		return spanIntersectP(spans, Spans(ray, spans), ray);
 	}
 
 	virtual bool Intersect(const Ray & ray, Interaction * inter)
 	{
-		Interaction rec1, rec2;
-		if (!(m_shape1->Intersect(ray, &rec1) && m_shape2->Intersect(ray, &rec2)))
-			return false;
-		if (m_shape2->isInside(rec1.p) && m_shape1->isInside(rec2.p))	//㶼ϷȡĽ
-			* inter = (rec1.p - ray.o).Length() > (rec2.p - ray.o).Length() ? rec2 : rec1;
-		else if (m_shape2->isInside(rec1.p))
-			* inter = rec1;
-		else if (m_shape1->isInside(rec2.p))
-			* inter = rec2;
-		else
-			return false;
-		return true;
+		Span spans[MaxSpans];
+		return spanIntersect(spans, Spans(ray, spans), ray, inter);
+	}
+	virtual bool IntersectT(const Ray& ray, Hit* hit)
+	{
+		Span spans[MaxSpans];
+		return spanIntersectT(spans, Spans(ray, spans), ray, hit);
 	}
 };
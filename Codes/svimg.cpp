@@ -8,8 +8,11 @@ Image::Image(const Point2i& resolution, const std::string& filename)
 	pixel = (Pixel*)malloc(fullResolution.x * fullResolution.y * sizeof(Pixel));
 }
 
+//Can be called again to overwrite the file with the current pixels
 void Image::writeImage()
 {
+	if (!out.is_open())
+		out.open("./Image/" + filename + ".ppm", std::ofstream::out | std::ofstream::trunc);
 	out << "P3" << std::endl;
 	out << fullResolution.x << ' ' << fullResolution.y << std::endl;
 	out << "255" << std::endl;
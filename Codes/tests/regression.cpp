@@ -0,0 +1,331 @@
+//Regression tests.
+//A plain program over the headers, without the renderer's main; from Codes:
+//	g++ -std=c++17 -O2 -I. tests/regression.cpp svimg.cpp color.cpp -o regression
+//It prints the failed checks and returns their number.
+#include"header.h"
+#include"geometry.h"
+#include"surface.h"
+#include"staticcsg.h"
+#include"shapetree.h"
+#include"object.h"
+#include"mesh.h"
+#include"bezier.h"
+#include"direct.h"
+#include"linesweep.h"
+#include"instance.h"
+#include<cstdio>
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+//More overlapping children than MaxSpans, most of them behind the ray:
+//the spans ahead must still be there.
+static void spansBehindOrigin()
+{
+	Surface* row = new Disk(Point2d(0, 0), 3);
+	for (int i = 1; i < 40; i++)
+		row = new ShapeUnion(row, new Disk(Point2d(10 * i, 0), 3));
+	Ray ray(Point2d(255, 0), Vector2d(1, 0));
+
+	Span spans[MaxSpans];
+	int n = row->Spans(ray, spans);
+	CHECK(n > 0 && spans[0].t0 == 2);
+
+	Interaction rec;
+	CHECK(row->Intersect(ray, &rec) && fabs(rec.t - 2) < 1e-9);
+	CHECK(row->IntersectP(Ray(Point2d(255, 0), Vector2d(1, 0), 3)));
+
+	ShapeTree tree;
+	tree.Build(row);
+	CHECK(tree.Intersect(ray, &rec) && fabs(rec.t - 2) < 1e-9);
+
+	//from inside a disk, the exit
+	CHECK(row->Intersect(Ray(Point2d(251, 0), Vector2d(1, 0)), &rec) && fabs(rec.t - 2) < 1e-9);
+	CHECK(rec.n.x > 0);
+
+	Scene s;
+	Reflector m(Color(255, 255, 255));
+	s.scene_list.push_back(new Object(row, &m));
+	s.Build();
+	CHECK(s.Intersect(ray, &rec) && fabs(rec.t - 2) < 1e-9);
+}
+
+//A disk inside a box, both inside a half-plane: the innermost object is
+//the one a path takes the absorption of, whatever the order the scene
+//finds them in
+static void nestedMedia()
+{
+	Medium fog(0.1, 0.1, 0);
+	Object plane(new HalfPlane(0, 1, 0), &fog), box(new Box(Point2d(-20, 1), Point2d(20, 30)), &fog);
+	Object disk(new Disk(Point2d(0, 10), 3), &fog);
+	Scene s;
+	s.scene_list = { &disk, &box, &plane };
+	s.Build();
+
+	CHECK(s.Containing(Point2d(0, 10)) == &disk);
+	CHECK(s.Containing(Point2d(15, 5)) == &box);
+	CHECK(s.Containing(Point2d(15, 0.5)) == &plane);
+	CHECK(s.Containing(Point2d(0, -5)) == nullptr);
+
+	MediumStack media;
+	s.Enclosing(Point2d(0, 10), &media);
+	CHECK(media.n == 3 && media.Top() == &disk);
+	CHECK(media.n == 3 && media.objects[0] == &plane && media.objects[1] == &box);
+
+	//out of the disk: back in the box
+	Ray ray(Point2d(0, 10), Vector2d(1, 0));
+	Interaction rec;
+	CHECK(s.Intersect(ray, &rec) && rec.object == &disk);
+	media.Cross(rec, Ray(rec.p + rec.n * 0.01, ray.d));
+	CHECK(media.n == 2 && media.Top() == &box);
+	//and into it again, whichever order
+	media.Cross(rec, Ray(rec.p - rec.n * 0.01, -ray.d));
+	CHECK(media.n == 3 && media.Top() == &disk);
+
+	//the disk inside the half-plane alone
+	Scene t;
+	t.scene_list = { &disk, &plane };
+	t.Build();
+	MediumStack inPlane;
+	t.Enclosing(Point2d(0, 10), &inPlane);
+	CHECK(t.Containing(Point2d(0, 10)) == &disk && inPlane.Top() == &disk);
+}
+
+//More nested objects than MediumStack holds: it has to tell, for the
+//path to ask the scene instead
+static void deepMedia()
+{
+	Medium fog(0.1, 0.1, 0);
+	std::vector<Object> rings;
+	for (int i = 0; i < MediumStack::MaxDepth + 2; i++)
+		rings.push_back(Object(new Disk(Point2d(0, 0), 10 - i), &fog));
+	Scene s;
+	for (auto& o : rings)
+		s.scene_list.push_back(&o);
+	s.Build();
+
+	MediumStack media;
+	s.Enclosing(Point2d(0, 0), &media);
+	CHECK(media.overflowed && media.n == MediumStack::MaxDepth);
+	CHECK(s.Containing(Point2d(0, 0)) == &rings.back());
+
+	MediumStack shallow;
+	s.Enclosing(Point2d(9.5, 0), &shallow);
+	CHECK(!shallow.overflowed && shallow.n == 1 && shallow.Top() == &rings[0]);
+}
+
+//Rays through the vertices of a mesh cross the outline once there, or
+//twice or not at all if they only touch it
+static void meshVertices()
+{
+	LineMesh square;
+	square.AddLoop({ Point2d(0, 0), Point2d(10, 0), Point2d(10, 10), Point2d(0, 10) });
+	PolygonMesh mesh(&square);
+
+	//along the diagonal, through two corners
+	Ray diagonal(Point2d(-5, -5), Vector2d(1, 1));
+	Span spans[MaxSpans];
+	int n = mesh.Spans(diagonal, spans);
+	CHECK(n == 1 && fabs(spans[0].t0 - 5) < 1e-9 && fabs(spans[0].t1 - 15) < 1e-9);
+	Interaction rec;
+	CHECK(mesh.Intersect(diagonal, &rec) && fabs(rec.t - 5) < 1e-9);
+	CHECK(mesh.Intersect(Ray(Point2d(5, 5), Vector2d(1, 1)), &rec) && fabs(rec.t - 5) < 1e-9);
+
+	//touching the corner (10, 10) only
+	CHECK(mesh.Spans(Ray(Point2d(5, 15), Vector2d(1, -1)), spans) == 0);
+
+	//in through a corner, out through the middle of a side
+	Ray steep(Point2d(-5, -10), Vector2d(1, 2));
+	n = mesh.Spans(steep, spans);
+	CHECK(n == 1 && fabs(spans[0].t0 - 5) < 1e-9 && fabs(spans[0].t1 - 10) < 1e-9);
+	CHECK(mesh.Intersect(Ray(Point2d(2, 4), Vector2d(1, 2)), &rec) && fabs(rec.t - 3) < 1e-9);
+
+	//from inside, the span starts at the origin
+	n = mesh.Spans(Ray(Point2d(5, 5), Vector2d(1, 1)), spans);
+	CHECK(n == 1 && spans[0].t0 == 0 && !spans[0].s0 && fabs(spans[0].t1 - 5) < 1e-9);
+}
+
+//A row of more squares than spans fit: those ahead of the ray are the ones
+//kept, behind it or in front of the mesh
+static void meshRow()
+{
+	LineMesh row;
+	for (int i = 0; i < 50; i++)
+		row.AddLoop({ Point2d(10 * i, 0), Point2d(10 * i + 4, 0), Point2d(10 * i + 4, 4), Point2d(10 * i, 4) });
+	PolygonMesh mesh(&row);
+
+	Span spans[MaxSpans];
+	int n = mesh.Spans(Ray(Point2d(252, 2), Vector2d(1, 0)), spans);
+	CHECK(n == MaxSpans && spans[0].t0 == 0 && fabs(spans[0].t1 - 2) < 1e-9);
+	CHECK(n == MaxSpans && fabs(spans[1].t0 - 8) < 1e-9 && fabs(spans[1].t1 - 12) < 1e-9);
+	n = mesh.Spans(Ray(Point2d(-10, 2), Vector2d(1, 0)), spans);
+	CHECK(n == MaxSpans && fabs(spans[0].t0 - 10) < 1e-9 && fabs(spans[MaxSpans - 1].t1 - 164) < 1e-9);
+
+	Surface* u = new ShapeUnion(new PolygonMesh(&row), new Disk(Point2d(1000, 2), 1));
+	Interaction rec;
+	CHECK(u->Intersect(Ray(Point2d(305, 2), Vector2d(1, 0)), &rec) && fabs(rec.t - 5) < 1e-9);
+}
+
+//A mesh or a Bezier outline hiding part of a light: DirectLighting sees
+//their edges as it sees the ones of a box
+static void outlineShadows()
+{
+	Light light(Color(100, 100, 100));
+	Reflector wall(Color(255, 255, 255));
+	Object lamp(new Disk(Point2d(100, 0), 10), &light);
+	LineMesh square;
+	square.AddLoop({ Point2d(40, 2), Point2d(60, 2), Point2d(60, 20), Point2d(40, 20) });
+	BezierShape* curves = new BezierShape;
+	curves->AddLoop({ CubicBezier::Line(Point2d(40, 2), Point2d(60, 2)), CubicBezier::Line(Point2d(60, 2), Point2d(60, 20)),
+		CubicBezier::Line(Point2d(60, 20), Point2d(40, 20)), CubicBezier::Line(Point2d(40, 20), Point2d(40, 2)) });
+	curves->Build();
+	Object mesh(new PolygonMesh(&square), &wall), outline(curves, &wall), box(new Box(Point2d(40, 2), Point2d(60, 20)), &wall);
+
+	Scene withMesh, withOutline, withBox;
+	withMesh.scene_list = { &lamp, &mesh };
+	withOutline.scene_list = { &lamp, &outline };
+	withBox.scene_list = { &lamp, &box };
+	withMesh.Build();
+	withOutline.Build();
+	withBox.Build();
+	DirectLighting meshLighting(withMesh), outlineLighting(withOutline), boxLighting(withBox);
+	for (Point2d p : { Point2d(0, 0), Point2d(10, -3), Point2d(30, 5) })
+	{
+		double byBox = boxLighting.Li(p).r;
+		CHECK(byBox < 100 * asin(10 / Distance(p, Point2d(100, 0))) / PI);
+		CHECK(fabs(meshLighting.Li(p).r - byBox) < 1e-9);
+		CHECK(fabs(outlineLighting.Li(p).r - byBox) < 1e-9);
+	}
+}
+
+//Packets of rays through the corners of a box, and along its sides from
+//their planes, hit it as the rays alone do
+static void boxPackets()
+{
+	Box box(Point2d(0, 0), Point2d(10, 10));
+	for (Point2d o : { Point2d(-3.3, -7.1), Point2d(0, -5), Point2d(-5, 10), Point2d(5, 5) })
+	{
+		RayPacket packet(o);
+		packet.Add(Vector2d(0, 1));
+		packet.Add(Vector2d(1, 0));
+		packet.Add(Vector2d(0, -1));
+		for (int k = 0; packet.Add(Normalize(Point2d(10, 10) - o + Vector2d(k, -k) * 1e-9)); k++) {}
+		Interaction recs[PacketSize];
+		unsigned mask = box.IntersectPacket(packet, recs);
+		for (int i = 0; i < PacketSize; i++)
+		{
+			Interaction rec;
+			bool hit = box.Intersect(packet.ray(i), &rec);
+			CHECK(hit == ((mask >> i & 1) != 0));
+			if (hit && (mask >> i & 1))
+				CHECK(fabs(rec.t - recs[i].t) < 1e-9 && rec.n.x == recs[i].n.x && rec.n.y == recs[i].n.y);
+		}
+	}
+}
+
+//A swept line starting on a boundary steps past it, not past the thin
+//disk just beyond
+static void sweepPastOrigin()
+{
+	Light light(Color(100, 100, 100));
+	Object edge(new Disk(Point2d(-5, 0), 5), &light), thin(new Disk(Point2d(0.3, 0), 0.1), &light);
+	Scene s;
+	s.scene_list = { &edge, &thin };
+	s.Build();
+	std::vector<LineCrossing> crossings;
+	RenderSettings settings;
+	sweepCrossings(Point2d(0, 0), Vector2d(1, 0), 10, s, &crossings, RandomStream(0, 0), settings, nullptr);
+	CHECK(crossings.size() == 2 && fabs(crossings[0].t - 0.2) < 1e-9 && fabs(crossings[1].t - 0.4) < 1e-9);
+}
+
+//A light and the camera inside the same object: next-event estimation
+//sees the light, as the paths that hit it do
+static void lightInsideMedium()
+{
+	Medium air(0, 0, 0);
+	Light light(Color(100, 100, 100));
+	Object room(new Box(Point2d(-100, -100), Point2d(100, 100)), &air), lamp(new Disk(Point2d(30, 0), 5), &light);
+	Scene s;
+	s.scene_list = { &room, &lamp };
+	s.Build();
+
+	RenderSettings withNee, without;
+	withNee.maxDepth = without.maxDepth = 0;
+	without.nee = false;
+	const int n = 20000;
+	double a = 0, b = 0;
+	for (int k = 0; k < n; k++)
+	{
+		//a ray each, Intersect shrinks tMax
+		Vector2d d(cos(2 * PI * (k + 0.5) / n), sin(2 * PI * (k + 0.5) / n));
+		Interaction rec;
+		RandomStream rngA(0, k), rngB(0, k);
+		a += tracePixel(Ray(Point2d(0, 0), d), &rec, s, rngA, withNee).r;
+		b += tracePixel(Ray(Point2d(0, 0), d), &rec, s, rngB, without).r;
+	}
+	//100 times the share of the directions the disk takes
+	double expected = 100 * asin(5.0 / 30) / PI;
+	CHECK(fabs(a / n - expected) < 0.05 * expected && fabs(b / n - expected) < 0.05 * expected);
+}
+
+//A disk stretched into an ellipse in front of a light: DirectLighting and
+//the boundary samples of the light see the ellipse, not nothing
+static void stretchedDisk()
+{
+	Light light(Color(100, 100, 100));
+	Reflector wall(Color(255, 255, 255));
+	Disk unit(Point2d(0, 0), 1);
+	Object ellipse(new Instance(&unit, Translate(Vector2d(50, 7)) * Scale(6, 20)), &wall);
+	Object lamp(new Box(Point2d(100, -50), Point2d(110, 50)), &light);
+	Scene s;
+	s.scene_list = { &ellipse, &lamp };
+	s.Build();
+
+	DirectLighting lighting(s);
+	const int n = 400000;
+	double bruteForce = 0;
+	for (int k = 0; k < n; k++)
+	{
+		double theta = 2 * PI * (k + 0.5) / n;
+		Interaction rec;
+		if (s.Intersect(Ray(Point2d(0, 0), Vector2d(cos(theta), sin(theta))), &rec))
+			bruteForce += materialLi(rec.mat).r;
+	}
+	bruteForce /= n;
+	CHECK(fabs(lighting.Li(Point2d(0, 0)).r - bruteForce) < 1e-3 * bruteForce);
+
+	//by arc length: as far around as the ellipse's perimeter, Ramanujan's
+	Object glowing(new Instance(&unit, Scale(6, 20)), &light);
+	Point2d p;
+	Vector2d normal;
+	double length;
+	CHECK(glowing.surface->SampleBoundary(0.3, &p, &normal, &length));
+	double h = (20.0 - 6) * (20.0 - 6) / ((20.0 + 6) * (20.0 + 6));
+	CHECK(fabs(length - PI * 26 * (1 + 3 * h / (10 + sqrt(4 - 3 * h)))) < 1e-3 * length);
+	double firstQuarter = 0;
+	for (int k = 0; k < 1000; k++)
+	{
+		glowing.surface->SampleBoundary((k + 0.5) / 4000, &p, &normal, &length);
+		if (p.x > 0 && p.y > 0) firstQuarter++;
+	}
+	CHECK(firstQuarter >= 990);
+}
+
+int main()
+{
+	spansBehindOrigin();
+	nestedMedia();
+	deepMedia();
+	meshVertices();
+	meshRow();
+	boxPackets();
+	sweepPastOrigin();
+	lightInsideMedium();
+	stretchedDisk();
+	outlineShadows();
+	if (failures == 0)
+		printf("all passed\n");
+	return failures;
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include"header.h"
+#include"geometry.h"
+
+//2D affine transforms.
+//A point is (x, y, 1) in homogeneous coordinates, so an affine map of the
+//plane is a 3x3 matrix whose last row is (0, 0, 1). A Transform keeps its
+//inverse along, as it is needed for every ray.
+
+struct Matrix3x3
+{
+	double m[3][3];
+
+	Matrix3x3()
+	{
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				m[i][j] = i == j;
+	}
+	Matrix3x3(double t00, double t01, double t02,
+		double t10, double t11, double t12,
+		double t20, double t21, double t22)
+	{
+		m[0][0] = t00, m[0][1] = t01, m[0][2] = t02;
+		m[1][0] = t10, m[1][1] = t11, m[1][2] = t12;
+		m[2][0] = t20, m[2][1] = t21, m[2][2] = t22;
+	}
+
+	bool operator==(const Matrix3x3& m2) const
+	{
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				if (m[i][j] != m2.m[i][j]) return false;
+		return true;
+	}
+	bool operator!=(const Matrix3x3& m2) const { return !(*this == m2); }
+
+	friend Matrix3x3 Mul(const Matrix3x3& m1, const Matrix3x3& m2)
+	{
+		Matrix3x3 r;
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				r.m[i][j] = m1.m[i][0] * m2.m[0][j] + m1.m[i][1] * m2.m[1][j] + m1.m[i][2] * m2.m[2][j];
+		return r;
+	}
+	friend Matrix3x3 Transpose(const Matrix3x3& m)
+	{
+		return Matrix3x3(m.m[0][0], m.m[1][0], m.m[2][0],
+			m.m[0][1], m.m[1][1], m.m[2][1],
+			m.m[0][2], m.m[1][2], m.m[2][2]);
+	}
+	//of an affine matrix: the inverse 2x2 part, and the translation undone by it
+	friend Matrix3x3 Inverse(const Matrix3x3& m)
+	{
+		double det = m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0];
+		assert(det != 0);
+		double a = m.m[1][1] / det, b = -m.m[0][1] / det;
+		double c = -m.m[1][0] / det, d = m.m[0][0] / det;
+		return Matrix3x3(a, b, -(a * m.m[0][2] + b * m.m[1][2]),
+			c, d, -(c * m.m[0][2] + d * m.m[1][2]),
+			0, 0, 1);
+	}
+};
+
+class Transform
+{
+public:
+	Transform() {}
+	Transform(const Matrix3x3& m) :m(m), mInv(Inverse(m)) {}
+	Transform(const Matrix3x3& m, const Matrix3x3& mInv) :m(m), mInv(mInv) {}
+
+	friend Transform Inverse(const Transform& t) { return Transform(t.mInv, t.m); }
+	//this after t2
+	Transform operator*(const Transform& t2) const
+	{
+		return Transform(Mul(m, t2.m), Mul(t2.mInv, mInv));
+	}
+	bool IsIdentity() const { return m == Matrix3x3(); }
+	const Matrix3x3& GetMatrix() const { return m; }
+	const Matrix3x3& GetInverseMatrix() const { return mInv; }
+
+	Point2d operator()(const Point2d& p) const
+	{
+		return Point2d(m.m[0][0] * p.x + m.m[0][1] * p.y + m.m[0][2],
+			m.m[1][0] * p.x + m.m[1][1] * p.y + m.m[1][2]);
+	}
+	Vector2d operator()(const Vector2d& v) const
+	{
+		return Vector2d(m.m[0][0] * v.x + m.m[0][1] * v.y,
+			m.m[1][0] * v.x + m.m[1][1] * v.y);
+	}
+	//by the inverse transpose, to stay perpendicular to the boundary; not normalized
+	Vector2d Normal(const Vector2d& n) const
+	{
+		return Vector2d(mInv.m[0][0] * n.x + mInv.m[1][0] * n.y,
+			mInv.m[0][1] * n.x + mInv.m[1][1] * n.y);
+	}
+	//the direction is not normalized, so t means the same point on both rays
+	Ray operator()(const Ray& r) const
+	{
+		return Ray((*this)(r.o), (*this)(r.d), r.tMax);
+	}
+	//the box around the four transformed corners; unbounded boxes stay unbounded
+	Bounds2d operator()(const Bounds2d& b) const
+	{
+		if (b.IsEmpty()) return b;
+		if (!b.IsFinite())
+			return Bounds2d(Point2d(-InfinityDouble, -InfinityDouble), Point2d(InfinityDouble, InfinityDouble));
+		Bounds2d ret((*this)(b.pMin), (*this)(b.pMax));
+		ret = Union(ret, (*this)(Point2d(b.pMin.x, b.pMax.y)));
+		ret = Union(ret, (*this)(Point2d(b.pMax.x, b.pMin.y)));
+		return ret;
+	}
+
+	//whether circles stay circles: a rotation or reflection with one scale
+	//for both axes, *scale
+	bool IsSimilarity(double* scale) const
+	{
+		double a = m.m[0][0], b = m.m[0][1], c = m.m[1][0], d = m.m[1][1];
+		double sx = a * a + c * c, sy = b * b + d * d;
+		*scale = sqrt(sx);
+		return fabs(sx - sy) <= 1e-9 * sx && fabs(a * b + c * d) <= 1e-9 * sx;
+	}
+
+private:
+	Matrix3x3 m, mInv;
+};
+
+inline Transform Translate(const Vector2d& delta)
+{
+	Matrix3x3 m(1, 0, delta.x,
+		0, 1, delta.y,
+		0, 0, 1);
+	Matrix3x3 mInv(1, 0, -delta.x,
+		0, 1, -delta.y,
+		0, 0, 1);
+	return Transform(m, mInv);
+}
+inline Transform Scale(double x, double y)
+{
+	Matrix3x3 m(x, 0, 0,
+		0, y, 0,
+		0, 0, 1);
+	Matrix3x3 mInv(1 / x, 0, 0,
+		0, 1 / y, 0,
+		0, 0, 1);
+	return Transform(m, mInv);
+}
+//counter-clockwise by theta radians about the origin
+inline Transform Rotate(double theta)
+{
+	double s = sin(theta), c = cos(theta);
+	Matrix3x3 m(c, -s, 0,
+		s, c, 0,
+		0, 0, 1);
+	return Transform(m, Transpose(m));
+}
@@ -10,6 +10,7 @@
 
 constexpr double PI = 3.14159265358979323846;
 constexpr double Inv_4PI = 0.7853981634;
+constexpr double Inv_2PI = 0.15915494309189533577;
 
 //Infinity of Double
 static constexpr double InfinityDouble = std::numeric_limits<double>::infinity();